@@ -36,6 +36,68 @@ function binTimes() {
     return {exposes, toZigbee, isModernExtend: true};
 }
 
+function binSchedule() {
+    const bins = ["black", "green", "brown"];
+    const maxSkips = 8;
+    const units = {days: 1, weeks: 7};
+    const exposes = [];
+    exposes.push(
+        e.composite("schedule", "schedule", ea.SET)
+            .withDescription("Recurring collection rule for one bin, the device works out the next dates itself")
+            .withFeature(e.enum("bin", ea.SET, bins))
+            .withFeature(e.numeric("anchor", ea.SET).withUnit("s").withDescription("Time of any one collection"))
+            .withFeature(e.numeric("period", ea.SET).withDescription("Days or weeks between collections, 0 removes the rule"))
+            .withFeature(e.enum("unit", ea.SET, Object.keys(units)).withDescription("Unit of the period, the device is sent whole days"))
+            .withFeature(e.text("skips", ea.SET).withDescription(`Comma separated times on days without collection, at most ${maxSkips}`))
+    );
+
+    const toZigbee = [
+        {
+            key: ["schedule"],
+            convertSet: async (entity, key, value, meta) => {
+                utils.assertEndpoint(entity);
+
+                const OneJan2000Secs = constants.OneJanuary2000 / 1000;
+                const skips = String(value.skips ?? "").split(",")
+                    .map((s) => Number(s.trim()))
+                    .filter((s) => s > OneJan2000Secs)
+                    .slice(0, maxSkips)
+                    .map((s) => s - OneJan2000Secs);
+                const unit = value.unit ?? "days";
+                if (!Object.hasOwn(units, unit)) throw new Error(`Unknown unit '${unit}'`);
+                const data = {
+                    bin: bins.indexOf(value.bin),
+                    anchor: value.anchor != null && value.anchor > OneJan2000Secs ? value.anchor - OneJan2000Secs : 0,
+                    period: (value.period ?? 0) * units[unit],
+                    skipCount: skips.length,
+                    skips
+                };
+                if (data.bin < 0) throw new Error(`Unknown bin '${value.bin}'`);
+                if (data.period > 0xFFFF) throw new Error(`Period of ${data.period} days is too long`);
+                await entity.command("tcSpecificBin", "setSchedule", data);
+
+                return {state: {schedule: value}};
+            }
+        }
+    ];
+
+    return {exposes, toZigbee, isModernExtend: true};
+}
+
+function displayStats() {
+    // Reported by the device with the battery, read only
+    const stat = (name, attribute, description, unit) => m.numeric({
+        name, cluster: "tcSpecificBin", attribute, description, unit,
+        access: "STATE_GET", entityCategory: "diagnostic"
+    });
+    return [
+        stat("frame_skips", "frameSkips", "Refreshes skipped as the frame was unchanged, since the first boot"),
+        stat("busy_reset", "busyReset", "Time the panel was busy in its last reset", "ms"),
+        stat("busy_refresh", "busyRefresh", "Time the panel was busy in its last refresh", "ms"),
+        stat("busy_sleep", "busySleep", "Time the panel was busy entering deep sleep", "ms"),
+    ];
+}
+
 export default {
     zigbeeModel: ['BinStatus'],
     model: 'BinStatus',
@@ -45,7 +107,12 @@ export default {
         m.deviceAddCustomCluster("tcSpecificBin", {
             manufacturerCode: 0x1234,
             ID: 0xFC12,
-            attributes: {},
+            attributes: {
+                frameSkips: { ID: 0x0000, type: Zcl.DataType.UINT32 },
+                busyReset: { ID: 0x0001, type: Zcl.DataType.UINT32 },
+                busyRefresh: { ID: 0x0002, type: Zcl.DataType.UINT32 },
+                busySleep: { ID: 0x0003, type: Zcl.DataType.UINT32 },
+            },
             commands: {
                 setDisplayTimes: {
                     ID: 0x01,
@@ -55,10 +122,22 @@ export default {
                         { name: "brown", type: Zcl.DataType.UINT32 },
                     ],
                 },
+                setSchedule: {
+                    ID: 0x02,
+                    parameters: [
+                        { name: "bin", type: Zcl.DataType.UINT8 },
+                        { name: "anchor", type: Zcl.DataType.UINT32 },
+                        { name: "period", type: Zcl.DataType.UINT16 },
+                        { name: "skipCount", type: Zcl.DataType.UINT8 },
+                        { name: "skips", type: Zcl.BuffaloZclDataType.LIST_UINT32 },
+                    ],
+                },
             },
             commandsResponse: {},
         }),
         binTimes(),
+        binSchedule(),
+        ...displayStats(),
         m.battery({
             voltage: true
         })
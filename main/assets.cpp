@@ -0,0 +1,199 @@
+#include "assets.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "ASSETS";
+
+AssetPack assets;
+
+// What LVGL needs in RAM to draw a packed font, everything else stays in flash
+struct AssetFont {
+    lv_font_t font;
+    lv_font_fmt_txt_dsc_t dsc;
+    lv_font_fmt_txt_cmap_t cmap;
+    lv_font_fmt_txt_kern_classes_t kern;
+};
+
+bool AssetPack::begin() {
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, ASSET_PARTITION);
+    if (!part) {
+        ESP_LOGW(TAG, "No %s partition", ASSET_PARTITION);
+        return false;
+    }
+
+    asset_header_t header;
+    esp_err_t err = esp_partition_read(part, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_partition_read failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    if (header.magic != ASSET_MAGIC || header.version != ASSET_VERSION) {
+        ESP_LOGW(TAG, "No asset pack, using built-in assets");
+        return false;
+    }
+    if (header.size > part->size || header.size < sizeof(header) + header.count * sizeof(asset_entry_t)) {
+        ESP_LOGW(TAG, "Invalid asset pack size: %lu", header.size);
+        return false;
+    }
+
+    // Only the pages the pack covers take MMU entries
+    const void *ptr;
+    err = esp_partition_mmap(part, 0, header.size, ESP_PARTITION_MMAP_DATA, &ptr, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_partition_mmap failed: %s", esp_err_to_name(err));
+        return false;
+    }
+    const uint8_t *data = (const uint8_t *) ptr;
+
+    if (esp_rom_crc32_le(0, data + sizeof(header), header.size - sizeof(header)) != header.crc) {
+        ESP_LOGW(TAG, "Asset pack CRC mismatch, using built-in assets");
+        esp_partition_munmap(handle);
+        return false;
+    }
+
+    const asset_entry_t *table = (const asset_entry_t *) (data + sizeof(header));
+    for (uint16_t i = 0; i < header.count; i++) {
+        if (table[i].offset > header.size || table[i].size > header.size - table[i].offset) {
+            ESP_LOGW(TAG, "Asset %.*s out of bounds", ASSET_NAME_LEN, table[i].name);
+            esp_partition_munmap(handle);
+            return false;
+        }
+    }
+
+    images = (lv_image_dsc_t *) calloc(header.count, sizeof(lv_image_dsc_t));
+    fonts = (AssetFont **) calloc(header.count, sizeof(AssetFont *));
+    if (!images || !fonts) {
+        free(images);
+        free(fonts);
+        images = nullptr;
+        fonts = nullptr;
+        esp_partition_munmap(handle);
+        return false;
+    }
+    for (uint16_t i = 0; i < header.count; i++) {
+        const asset_entry_t &entry = table[i];
+        if (entry.type != ASSET_IMAGE || entry.size < sizeof(asset_image_t)) continue;
+
+        // LVGL reads the pixels in place, so only images it can draw from
+        // inside their entry are kept: I1, a palette of two colours, then
+        // h rows of stride bytes
+        const asset_image_t *img = (const asset_image_t *) (data + entry.offset);
+        uint32_t size = entry.size - sizeof(asset_image_t);
+        if (img->cf != LV_COLOR_FORMAT_I1 || img->stride < (img->w + 7) / 8 ||
+            8 + (uint32_t) img->h * img->stride > size) {
+            ESP_LOGW(TAG, "Invalid image %.*s", ASSET_NAME_LEN, entry.name);
+            continue;
+        }
+
+        lv_image_dsc_t &dsc = images[i];
+        dsc.header.magic = LV_IMAGE_HEADER_MAGIC;
+        dsc.header.cf = img->cf;
+        dsc.header.w = img->w;
+        dsc.header.h = img->h;
+        dsc.header.stride = img->stride;
+        dsc.data_size = size;
+        dsc.data = (const uint8_t *) (img + 1);
+    }
+
+    base = data;
+    entries = table;
+    count = header.count;
+    ESP_LOGI(TAG, "Mapped %d assets, %lu bytes", count, header.size);
+    return true;
+}
+
+const asset_entry_t* AssetPack::find(const char *name, AssetType type) {
+    for (uint16_t i = 0; i < count; i++) {
+        if (entries[i].type == type && !strncmp(entries[i].name, name, ASSET_NAME_LEN)) return &entries[i];
+    }
+    return nullptr;
+}
+
+// Null when the pack has no such image, callers fall back to the built-in one
+const lv_image_dsc_t* AssetPack::image(const char *name) {
+    const asset_entry_t *entry = find(name, ASSET_IMAGE);
+    if (!entry || !images[entry - entries].data) return nullptr;
+    return &images[entry - entries];
+}
+
+bool AssetPack::constant(const char *name, int32_t &out) {
+    const asset_entry_t *entry = find(name, ASSET_CONST);
+    if (!entry || entry->size != sizeof(int32_t)) return false;
+    memcpy(&out, base + entry->offset, sizeof(out));
+    return true;
+}
+
+AssetFont* AssetPack::loadFont(const asset_entry_t &entry) {
+    if (entry.size < sizeof(asset_font_t)) return nullptr;
+    const uint8_t *data = base + entry.offset;
+    const asset_font_t *hdr = (const asset_font_t *) data;
+
+    // Tables in pack order, the bitmap runs to the end of the entry
+    uint32_t glyphs = sizeof(asset_font_t);
+    uint32_t unicode = glyphs + (hdr->count + 1) * sizeof(lv_font_fmt_txt_glyph_dsc_t);
+    uint32_t left = unicode + hdr->count * sizeof(uint16_t);
+    uint32_t right = left + (hdr->kern_classes ? hdr->count + 1 : 0);
+    uint32_t values = right + (hdr->kern_classes ? hdr->count + 1 : 0);
+    uint32_t bitmap = values + (hdr->kern_classes ? hdr->left_class_cnt * hdr->right_class_cnt : 0);
+    bitmap = (bitmap + 3) & ~3;
+    if (hdr->count == 0 || bitmap > entry.size) return nullptr;
+    if (hdr->bpp != 1 && hdr->bpp != 2 && hdr->bpp != 4 && hdr->bpp != 8) return nullptr;
+
+    const lv_font_fmt_txt_glyph_dsc_t *glyph_dsc = (const lv_font_fmt_txt_glyph_dsc_t *) (data + glyphs);
+    for (uint16_t i = 1; i <= hdr->count; i++) {
+        const lv_font_fmt_txt_glyph_dsc_t &g = glyph_dsc[i];
+        if (g.bitmap_index + (g.box_w * g.box_h * hdr->bpp + 7) / 8 > entry.size - bitmap) return nullptr;
+    }
+
+    AssetFont *f = (AssetFont *) calloc(1, sizeof(AssetFont));
+    if (!f) return nullptr;
+
+    f->cmap.range_start = hdr->range_start;
+    f->cmap.range_length = ((const uint16_t *) (data + unicode))[hdr->count - 1] + 1;
+    f->cmap.glyph_id_start = 1;
+    f->cmap.unicode_list = (const uint16_t *) (data + unicode);
+    f->cmap.list_length = hdr->count;
+    f->cmap.type = LV_FONT_FMT_TXT_CMAP_SPARSE_TINY;
+
+    if (hdr->kern_classes) {
+        f->kern.class_pair_values = (const int8_t *) (data + values);
+        f->kern.left_class_mapping = data + left;
+        f->kern.right_class_mapping = data + right;
+        f->kern.left_class_cnt = hdr->left_class_cnt;
+        f->kern.right_class_cnt = hdr->right_class_cnt;
+        f->dsc.kern_dsc = &f->kern;
+        f->dsc.kern_classes = 1;
+    }
+    f->dsc.glyph_bitmap = data + bitmap;
+    f->dsc.glyph_dsc = glyph_dsc;
+    f->dsc.cmaps = &f->cmap;
+    f->dsc.kern_scale = hdr->kern_scale;
+    f->dsc.cmap_num = 1;
+    f->dsc.bpp = hdr->bpp;
+    f->dsc.bitmap_format = LV_FONT_FMT_TXT_PLAIN;
+
+    f->font.get_glyph_dsc = lv_font_get_glyph_dsc_fmt_txt;
+    f->font.get_glyph_bitmap = lv_font_get_bitmap_fmt_txt;
+    f->font.line_height = hdr->line_height;
+    f->font.base_line = hdr->base_line;
+    f->font.subpx = LV_FONT_SUBPX_NONE;
+    f->font.underline_position = hdr->underline_position;
+    f->font.underline_thickness = hdr->underline_thickness;
+    f->font.dsc = &f->dsc;
+    return f;
+}
+
+// Null when the pack has no such font, callers fall back to the built-in one
+const lv_font_t* AssetPack::font(const char *name) {
+    const asset_entry_t *entry = find(name, ASSET_FONT);
+    if (!entry) return nullptr;
+    AssetFont *&f = fonts[entry - entries];
+    if (!f) f = loadFont(*entry);
+    if (!f) {
+        ESP_LOGW(TAG, "Invalid font %.*s", ASSET_NAME_LEN, entry->name);
+        return nullptr;
+    }
+    return &f->font;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_partition.h"
+#include "lvgl.h"
+
+#define ASSET_PARTITION "spiffs"
+#define ASSET_MAGIC 0x50415342 // "BSAP"
+#define ASSET_VERSION 1
+#define ASSET_NAME_LEN 24
+
+typedef enum {
+    ASSET_IMAGE = 1, // asset_image_t, then the pixel data
+    ASSET_FONT = 2,  // asset_font_t, glyphs, cmap, kerning, then the bitmap
+    ASSET_CONST = 3  // one int32_t layout constant
+} AssetType;
+
+// Pack layout, little endian and 4-byte aligned. Written by tools/asset_pack.py
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count; // entries following the header
+    uint32_t size;  // whole pack, header included
+    uint32_t crc;   // CRC-32 of everything after the header
+} asset_header_t;
+
+typedef struct __attribute__((packed)) {
+    char name[ASSET_NAME_LEN]; // NUL padded
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t offset; // from the start of the pack
+    uint32_t size;
+} asset_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t w;
+    uint16_t h;
+    uint16_t stride;
+    uint8_t cf; // lv_color_format_t
+    uint8_t reserved;
+} asset_image_t;
+
+// A font subset in LVGL's fmt_txt form, one sparse cmap from range_start.
+// Followed by count + 1 lv_font_fmt_txt_glyph_dsc_t (id 0 reserved),
+// count uint16_t codepoint offsets, the kerning class tables when
+// kern_classes is set, and the glyph bitmap 4-byte aligned
+typedef struct __attribute__((packed)) {
+    int16_t line_height;
+    int16_t base_line;
+    int8_t underline_position;
+    int8_t underline_thickness;
+    uint8_t bpp;
+    uint8_t reserved;
+    uint16_t count;
+    uint16_t kern_scale;
+    uint8_t left_class_cnt;
+    uint8_t right_class_cnt;
+    uint8_t kern_classes;
+    uint8_t reserved2;
+    uint32_t range_start;
+} asset_font_t;
+
+struct AssetFont;
+
+// Read-only asset pack memory-mapped from flash. LVGL reads pixel and glyph
+// data in place, only the descriptors pointing at it live in RAM
+class AssetPack {
+    public:
+        bool begin();
+        const lv_image_dsc_t* image(const char *name);
+        const lv_font_t* font(const char *name);
+        bool constant(const char *name, int32_t &out);
+    private:
+        const uint8_t *base = nullptr;
+        const asset_entry_t *entries = nullptr;
+        uint16_t count = 0;
+        lv_image_dsc_t *images = nullptr; // indexed like entries
+        AssetFont **fonts = nullptr;      // indexed like entries, built on first use
+        esp_partition_mmap_handle_t handle;
+
+        const asset_entry_t* find(const char *name, AssetType type);
+        AssetFont* loadFont(const asset_entry_t &entry);
+};
+
+extern AssetPack assets;
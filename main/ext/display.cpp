@@ -1,21 +1,72 @@
 #include "display.h"
 
 #include "epaper.h"
+#include "lite.h"
+#include "../assets.h"
 #include "../config.h"
+#include "../fonts.h"
 #include "../images.h"
+#include "../schedule.h"
 
 #include <algorithm>
+#include <stdarg.h>
+#include <sys/time.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
 #include "esp_timer.h"
 
 uint8_t daysGreen = 9;
 uint8_t daysBlack = 2;
 uint8_t daysBrown = 5;
 
-const lv_image_dsc_t* binImg[] = { &trash, &recycle, &gardenWaste };
-uint32_t imageScale[] = { 750, 800, 1024, 525, 560, 716 };
-uint32_t imagePivot[] = { 9, 10, 8 };
+// Icons come pre-scaled for the next collection and for the rows below,
+// shifted left to where scaling about their old pivot used to put them.
+// An asset pack can replace both by name, see loadAssets()
+const lv_image_dsc_t* binImg[2][3] = {
+    { &trashLarge, &recycleLarge, &gardenWasteLarge },
+    { &trashSmall, &recycleSmall, &gardenWasteSmall }
+};
+int32_t imageShift[2][3] = { { -17, -21, -24 }, { -9, -12, -14 } };
+const char * binImgName[2][3] = {
+    { "trashLarge", "recycleLarge", "gardenWasteLarge" },
+    { "trashSmall", "recycleSmall", "gardenWasteSmall" }
+};
 const char * binName[] = {"BLACK", "GREEN", "BROWN"};
 
+// Montserrat cut down to the glyphs the labels can show, see main/fonts.json.
+// An asset pack can replace them by name too
+enum { FONT_14, FONT_20, FONT_48 };
+const lv_font_t* labelFont[3] = { &montserrat14, &montserrat20, &montserrat48 };
+const char * labelFontName[3] = { "montserrat14", "montserrat20", "montserrat48" };
+
+static constexpr uint8_t rowOffset(uint8_t row) {
+    return 93 + row * 75;
+}
+
+#if DISPLAY_LITE
+enum { TEXT_HEAD, TEXT_INFO, TEXT_DAYS = TEXT_INFO + 3 };
+
+// What createUi and drawRow build, in the same order, for the lite renderer
+static constexpr LiteItem liteLayout[] = {
+    { LITE_IMAGE, false, 30, 15, 0, NULL, 0, NULL, false },
+    { LITE_LABEL, false, 90, 20, 0, &labelFont[FONT_20], TEXT_HEAD, NULL, true },
+    { LITE_LABEL, false, 100, 50, 0, &labelFont[FONT_14], TEXT_INFO, NULL, false },
+    { LITE_LABEL, true, -30, 10, 0, &labelFont[FONT_48], TEXT_DAYS, NULL, true },
+    { LITE_LABEL, true, -30, 55, 0, &labelFont[FONT_14], 0, "days", false },
+
+    { LITE_LINE, false, 8, rowOffset(0), Epaper::X - 8, NULL, 0, NULL, false },
+    { LITE_IMAGE, false, 30, rowOffset(0) + 17, 0, NULL, 1, NULL, false },
+    { LITE_LABEL, false, 100, rowOffset(0) + 27, 0, &labelFont[FONT_20], TEXT_INFO + 1, NULL, false },
+    { LITE_LABEL, true, -30, rowOffset(0) + 27, 0, &labelFont[FONT_20], TEXT_DAYS + 1, NULL, false },
+
+    { LITE_LINE, false, 8, rowOffset(1), Epaper::X - 8, NULL, 0, NULL, false },
+    { LITE_IMAGE, false, 30, rowOffset(1) + 17, 0, NULL, 2, NULL, false },
+    { LITE_LABEL, false, 100, rowOffset(1) + 27, 0, &labelFont[FONT_20], TEXT_INFO + 2, NULL, false },
+    { LITE_LABEL, true, -30, rowOffset(1) + 27, 0, &labelFont[FONT_20], TEXT_DAYS + 2, NULL, false },
+};
+static_assert(TEXT_DAYS + 3 == LITE_TEXTS, "lite layout texts");
+#endif
+
 bool DisplayDriver::lock(int timeout_ms) {
     const TickType_t timeout_ticks = (timeout_ms == -1) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
     return xSemaphoreTake(lvgl_mux, timeout_ticks) == pdTRUE;
@@ -25,10 +76,25 @@ void DisplayDriver::unlock() {
     xSemaphoreGive(lvgl_mux);
 }
 
+// Setting a label invalidates it even when the text is the same
+static void setLabel(lv_obj_t *label, char *shown, size_t size, const char *fmt, ...) {
+    char text[32];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if (!strncmp(text, shown, size)) return;
+    strlcpy(shown, text, size);
+#if DISPLAY_LITE != 1
+    lv_label_set_text(label, text);
+#endif
+}
+
 void DisplayDriver::drawRow(Bins bin, uint8_t row, time_t when) {
     uint16_t w = lv_display_get_horizontal_resolution(disp);
     lv_obj_t *scr = lv_screen_active();
-    uint8_t offset = 93 + (row * 75);
+    uint8_t offset = rowOffset(row);
 
     // Separator line
     lv_point_precise_t* lp = &line_points[row * 2];
@@ -42,104 +108,324 @@ void DisplayDriver::drawRow(Bins bin, uint8_t row, time_t when) {
 
     imgs[row + 1] = lv_image_create(scr);
     lv_obj_align(imgs[row + 1], LV_ALIGN_TOP_LEFT, 30, offset + 17);
+    watchIcon(imgs[row + 1]);
 
     infoText[row + 1] = lv_label_create(scr);
-    lv_obj_set_style_text_font(infoText[row + 1], &lv_font_montserrat_20, 0);
+    lv_obj_set_style_text_font(infoText[row + 1], labelFont[FONT_20], 0);
     lv_obj_align(infoText[row + 1], LV_ALIGN_TOP_LEFT, 100, offset + 27);
 
     dayText[row + 1] = lv_label_create(scr);
-    lv_obj_set_style_text_font(dayText[row + 1], &lv_font_montserrat_20, 0);
+    lv_obj_set_style_text_font(dayText[row + 1], labelFont[FONT_20], 0);
     lv_obj_align(dayText[row + 1], LV_ALIGN_TOP_RIGHT, -30, offset + 27);
 }
 
+// The icon blit on its own, so image formats can be compared per render.
+// LVGL's software renderer runs without threads here, so an object's draw
+// tasks have executed by the time its DRAW_MAIN_END arrives.
+void DisplayDriver::iconDrawEvent(lv_event_t *e) {
+    DisplayDriver *driver = (DisplayDriver*) lv_event_get_user_data(e);
+    int64_t now = esp_timer_get_time();
+    if (lv_event_get_code(e) == LV_EVENT_DRAW_MAIN_BEGIN) {
+        driver->iconStart = now;
+    } else {
+        driver->iconUs += now - driver->iconStart;
+    }
+}
+
+void DisplayDriver::watchIcon(lv_obj_t *img) {
+    lv_obj_add_event_cb(img, iconDrawEvent, LV_EVENT_DRAW_MAIN_BEGIN, this);
+    lv_obj_add_event_cb(img, iconDrawEvent, LV_EVENT_DRAW_MAIN_END, this);
+}
+
 void DisplayDriver::createUi() {
     lv_obj_t *scr = lv_screen_active();
     lv_obj_set_style_bg_color(scr, lv_color_white(), 0);
 
     imgs[0] = lv_image_create(scr);
     lv_obj_align(imgs[0], LV_ALIGN_TOP_LEFT, 30, 15);
+    watchIcon(imgs[0]);
 
     nextHead = lv_label_create(scr);
-    lv_obj_set_style_text_font(nextHead, &lv_font_montserrat_20, 0);
+    lv_obj_set_style_text_font(nextHead, labelFont[FONT_20], 0);
     lv_obj_align(nextHead, LV_ALIGN_TOP_LEFT, 90, 20);
 
     infoText[0] = lv_label_create(scr);
-    lv_obj_set_style_text_font(infoText[0], &lv_font_montserrat_14, 0);
+    lv_obj_set_style_text_font(infoText[0], labelFont[FONT_14], 0);
     lv_obj_align(infoText[0], LV_ALIGN_TOP_LEFT, 100, 50);
 
     dayText[0] = lv_label_create(scr);
-    lv_obj_set_style_text_font(dayText[0], &lv_font_montserrat_48, 0);
+    lv_obj_set_style_text_font(dayText[0], labelFont[FONT_48], 0);
     lv_obj_align(dayText[0], LV_ALIGN_TOP_RIGHT, -30, 10);
+#if DISPLAY_KWR
+    // Highlight the next collection on panels with a red plane
+    lv_obj_set_style_text_color(nextHead, lv_color_hex(0xFF0000), 0);
+    lv_obj_set_style_text_color(dayText[0], lv_color_hex(0xFF0000), 0);
+#endif
 
     lv_obj_t* daysLabel = lv_label_create(scr);
     lv_label_set_text(daysLabel, "days");
-    lv_obj_set_style_text_font(daysLabel, &lv_font_montserrat_14, 0);
+    lv_obj_set_style_text_font(daysLabel, labelFont[FONT_14], 0);
     lv_obj_align(daysLabel, LV_ALIGN_TOP_RIGHT, -30, 55);
 
     drawRow(GREEN, 0, 0);
     drawRow(BROWN, 1, 0);
 }
 
+// Icons and their shifts from the asset pack, "<icon>.dx" for the shift
+void DisplayDriver::loadAssets() {
+    if (!assets.begin()) return;
+
+    char key[ASSET_NAME_LEN];
+    for (uint8_t size = 0; size < 2; size++) {
+        for (uint8_t bin = 0; bin < 3; bin++) {
+            const lv_image_dsc_t *img = assets.image(binImgName[size][bin]);
+            if (img) binImg[size][bin] = img;
+            snprintf(key, sizeof(key), "%s.dx", binImgName[size][bin]);
+            assets.constant(key, imageShift[size][bin]);
+        }
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        const lv_font_t *font = assets.font(labelFontName[i]);
+        if (font) labelFont[i] = font;
+    }
+}
+
 void DisplayDriver::init() {
+    loadAssets();
+#if DISPLAY_LITE != 1
     lv_init();
+#endif
     disp = epaper.init();
 
     // Create LVGL task
     lvgl_mux = xSemaphoreCreateMutex();
 
+#if DISPLAY_LITE != 1
     // Create UI
     if (lock(-1)) {
         createUi();
         unlock();
     }
+#endif
+    ESP_LOGI("DISPLAY", "UI ready, %u bytes of heap free", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+
+    // One slot, so requests made while a render is pending collapse into it
+    render_queue = xQueueCreate(1, sizeof(uint8_t));
+    xTaskCreate(renderTask, "Display", 6144, this, 3, NULL);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = refreshTimer,
+        .arg = this,
+        .name = "refresh"
+    };
+    esp_timer_create(&timer_args, &refresh_timer);
+}
+
+void DisplayDriver::refreshTimer(void *arg) {
+    ((DisplayDriver*) arg)->requestRender();
+}
+
+// First second after now that shows different content
+time_t DisplayDriver::nextChange(time_t now) {
+    Bins bins[3];
+    time_t times[3];
+    collectionTimes(now, bins, times);
+
+    // Rules move on to their next collection at local midnight
+    time_t next = localMidnight(now, 1);
+
+    // A day counter steps down just after each whole number of days
+    // before its collection
+    for (uint8_t i = 0; i < 3; i++) {
+        if (times[i] < now) continue;
+        next = std::min(next, now + (times[i] - now) % 86400 + 1);
+    }
+    return next;
+}
+
+time_t DisplayDriver::scheduleRefresh(time_t now) {
+    time_t next = nextChange(now);
+
+    // One second late, so the clock has certainly crossed the boundary
+    timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t delay = (int64_t) (next - tv.tv_sec + 1) * 1000000 - tv.tv_usec;
+
+    esp_timer_stop(refresh_timer);
+    esp_timer_start_once(refresh_timer, std::max<int64_t>(delay, 0));
+    return next;
+}
+
+void DisplayDriver::requestRender() {
+    uint8_t request = RENDER_NOW;
+    xQueueOverwrite(render_queue, &request);
+}
+
+void DisplayDriver::requestRenderAhead() {
+    // Never displaces a pending render, the next idle call retries
+    uint8_t request = RENDER_AHEAD;
+    taskENTER_CRITICAL(&times_mux);
+    bool wanted = !ahead && aheadAt;
+    taskEXIT_CRITICAL(&times_mux);
+    if (wanted) xQueueSend(render_queue, &request, 0);
+}
+
+void DisplayDriver::renderTask(void *arg) {
+    DisplayDriver *driver = (DisplayDriver*) arg;
+    uint8_t request;
+    while (true) {
+        xQueueReceive(driver->render_queue, &request, portMAX_DELAY);
+        if (request == RENDER_AHEAD) {
+            driver->renderAhead();
+        } else {
+            driver->render();
+        }
+    }
 }
 
 void DisplayDriver::render() {
-    updateUi();
+    time_t now;
+    time(&now);
+
+    // Without new times a frame rendered ahead stays right until the
+    // next change after the time it was rendered for
+    if (ahead && aheadGeneration == generation && now >= aheadAt &&
+        now < nextChange(aheadAt)) {
+        epaper.showAhead();
+    } else {
+#if DISPLAY_LITE == 1
+        // Lite frames are always whole
+        if (ahead) epaper.dropAhead();
+#else
+        if (ahead && epaper.dropAhead() && lock(-1)) {
+            lv_obj_invalidate(lv_screen_active());
+            unlock();
+        }
+#endif
+        drawFrame(now);
+    }
+    time_t next = scheduleRefresh(now);
+    taskENTER_CRITICAL(&times_mux);
+    ahead = false;
+    aheadAt = next;
+    taskEXIT_CRITICAL(&times_mux);
+}
+
+void DisplayDriver::renderAhead() {
+    if (ahead || !aheadAt) return;
+
+    // The scheduled wake then only has to send the frame, and a render
+    // that fails does so hours before it is due
+    aheadGeneration = generation;
+    epaper.renderAhead(true);
+    bool drawn = drawFrame(aheadAt);
+    epaper.renderAhead(false);
+    taskENTER_CRITICAL(&times_mux);
+    ahead = drawn;
+    taskEXIT_CRITICAL(&times_mux);
+}
+
+bool DisplayDriver::drawFrame(time_t when) {
+    if (!updateUi(when)) return false;
+
+    // Render buffers only take heap until the frame is converted and sent
+#if DISPLAY_LITE == 1
+    epaper.reserveArena();
+    bool drawn = drawLite();
+#else
+    bool restored = epaper.reserveArena();
+    iconUs = 0;
     lv_timer_handler(); // Ensure screen is updated
 
-    epaper.power();
-    if (lock(100)) {
-        lv_obj_invalidate(lv_screen_active());
+    bool drawn = lock(100);
+    if (drawn) {
+        // The lite renderer draws whole frames, so LVGL has to as well, and
+        // areas can only be patched into a frame that could be restored
+        if (DISPLAY_LITE == 2 || !restored) lv_obj_invalidate(lv_screen_active());
         lv_refr_now(disp);
         unlock();
+        ESP_LOGI("DISPLAY", "Icons drawn in %lld us", iconUs);
     }
+
+#if DISPLAY_LITE == 2
+    // LVGL's frame is the reference, the lite one must match it bit for bit
+    if (drawn && epaper.checkStart()) {
+        drawLite();
+        epaper.checkEnd();
+    }
+#endif
+#endif
+    epaper.releaseArena();
+    return drawn;
 }
 
-void DisplayDriver::updateUi() {
-    time_t now;
-    time(&now);
+#if DISPLAY_LITE
+bool DisplayDriver::drawLite() {
+    if (!lock(100)) return false;
 
-    if (!imgs[0] || !lock(1000)) return;
+    LiteContent content;
+    for (uint8_t i = 0; i < 3; i++) {
+        bool shown = shownImg[i] >= 0;
+        content.img[i] = shown ? binImg[i != 0][shownImg[i]] : NULL;
+        content.imgShift[i] = shown ? imageShift[i != 0][shownImg[i]] : 0;
+        content.text[TEXT_INFO + i] = shownInfo[i];
+        content.text[TEXT_DAYS + i] = shownDays[i];
+    }
+    content.text[TEXT_HEAD] = shownHead;
+
+    lite.draw(liteLayout, sizeof(liteLayout) / sizeof(liteLayout[0]), content);
+    unlock();
+    return true;
+}
+#endif
+
+bool DisplayDriver::updateUi(time_t now) {
+    Bins bins[3];
+    time_t times[3];
+    collectionTimes(now, bins, times);
+
+#if DISPLAY_LITE != 1
+    if (!imgs[0]) return false;
+#endif
+    if (!lock(1000)) return false;
 
     for (uint8_t i = 0; i < 3; i++) {
         uint16_t dayCount = ((times[i] - now) / 86400) + 1;
 
-        lv_image_set_src(imgs[i], binImg[bins[i]]);
-        lv_image_set_pivot(imgs[i], imagePivot[bins[i]], 0);
-        lv_image_set_scale(imgs[i], imageScale[bins[i] + (i == 0 ? 0 : 3)]);
+        if (shownImg[i] != bins[i]) {
+#if DISPLAY_LITE != 1
+            lv_image_set_src(imgs[i], binImg[i != 0][bins[i]]);
+            lv_obj_set_x(imgs[i], 30 + imageShift[i != 0][bins[i]]);
+#endif
+            shownImg[i] = bins[i];
+        }
 
         tm* ti = localtime(&times[i]);
         if (i == 0) {
-            lv_label_set_text_fmt(dayText[i], "%d", dayCount);
-            lv_label_set_text_fmt(infoText[i], "On %02d/%02d/%04d", ti->tm_mday, ti->tm_mon + 1, ti->tm_year + 1900);
-            lv_label_set_text_fmt(nextHead, "Next collection: %s", binName[bins[i]]);
+            setLabel(dayText[i], shownDays[i], sizeof(shownDays[i]), "%d", dayCount);
+            setLabel(infoText[i], shownInfo[i], sizeof(shownInfo[i]), "On %02d/%02d/%04d", ti->tm_mday, ti->tm_mon + 1, ti->tm_year + 1900);
+            setLabel(nextHead, shownHead, sizeof(shownHead), "Next collection: %s", binName[bins[i]]);
         } else {
-            lv_label_set_text_fmt(dayText[i], "[%d]", dayCount);
-            lv_label_set_text_fmt(infoText[i], "%s on %02d/%02d/%04d", binName[bins[i]], ti->tm_mday, ti->tm_mon + 1, ti->tm_year + 1900);
+            setLabel(dayText[i], shownDays[i], sizeof(shownDays[i]), "[%d]", dayCount);
+            setLabel(infoText[i], shownInfo[i], sizeof(shownInfo[i]), "%s on %02d/%02d/%04d", binName[bins[i]], ti->tm_mday, ti->tm_mon + 1, ti->tm_year + 1900);
         }
     }
 
     unlock();
+    return true;
 }
 
-void DisplayDriver::updateTimes(time_t black, time_t green, time_t brown) {
-    bins[0] = Bins::BLACK;
-    bins[1] = Bins::GREEN;
-    bins[2] = Bins::BROWN;
-    times[0] = black;
-    times[1] = green;
-    times[2] = brown;
+void DisplayDriver::collectionTimes(time_t now, Bins bins[3], time_t times[3]) {
+    bin_rule_t rules[3];
+    taskENTER_CRITICAL(&times_mux);
+    std::copy(fixedTimes, fixedTimes + 3, times);
+    std::copy(this->rules, this->rules + 3, rules);
+    taskEXIT_CRITICAL(&times_mux);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        bins[i] = (Bins) i;
+        if (rules[i].period) times[i] = nextCollection(rules[i], now);
+    }
 
     for (uint8_t i = 0; i < 2; ++i) {
         for (uint8_t j = i+1; j < 3; ++j) {
@@ -151,4 +437,21 @@ void DisplayDriver::updateTimes(time_t black, time_t green, time_t brown) {
     }
 }
 
+void DisplayDriver::updateTimes(time_t black, time_t green, time_t brown) {
+    // Called from the Zigbee task while the display task may be reading
+    taskENTER_CRITICAL(&times_mux);
+    fixedTimes[Bins::BLACK] = black;
+    fixedTimes[Bins::GREEN] = green;
+    fixedTimes[Bins::BROWN] = brown;
+    generation++;
+    taskEXIT_CRITICAL(&times_mux);
+}
+
+void DisplayDriver::updateRule(Bins bin, const bin_rule_t &rule) {
+    taskENTER_CRITICAL(&times_mux);
+    rules[bin] = rule;
+    generation++;
+    taskEXIT_CRITICAL(&times_mux);
+}
+
 DisplayDriver eink;
@@ -1,28 +1,49 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
 
 #include "lvgl.h"
+#include "../schedule.h"
 
 typedef enum {
     BLACK, GREEN, BROWN
 } Bins;
 
+typedef enum {
+    RENDER_NOW, RENDER_AHEAD
+} RenderRequest;
+
 class DisplayDriver {
     public:
         void init();
-        void render();
+        void requestRender();
+        void requestRenderAhead();
 
         void updateTimes(time_t black, time_t green, time_t brown);
+        void updateRule(Bins bin, const bin_rule_t &rule);
 
         bool lock(int timeout_ms);
         void unlock();
     private:
         lv_display_t *disp;
         SemaphoreHandle_t lvgl_mux = NULL;
+        QueueHandle_t render_queue = NULL;
+        esp_timer_handle_t refresh_timer = NULL;
+        portMUX_TYPE times_mux = portMUX_INITIALIZER_UNLOCKED;
+
+        // Indexed by bin, a rule with a period overrides the fixed time
+        time_t fixedTimes[3] = {};
+        bin_rule_t rules[3] = {};
+        uint32_t generation = 0; // bumped on every change to the above
 
-        Bins bins[3];
-        time_t times[3];
+        // Frame for the next scheduled refresh, rendered while idle. Only
+        // the render task writes these, under times_mux as other tasks
+        // check them through requestRenderAhead
+        bool ahead = false;
+        time_t aheadAt = 0;
+        uint32_t aheadGeneration = 0;
 
         uint8_t margin = 8;
         lv_point_precise_t line_points[4];
@@ -33,8 +54,31 @@ class DisplayDriver {
         lv_obj_t* infoText[3];
         lv_obj_t* nextHead;
 
+        // Last values applied to each widget, unchanged ones are left alone
+        // so LVGL only redraws and flushes what actually moved
+        int8_t shownImg[3] = { -1, -1, -1 };
+        char shownDays[3][8] = {};
+        char shownInfo[3][32] = {};
+        char shownHead[32] = {};
+
+        // Time LVGL spends drawing the icons in one render
+        int64_t iconStart = 0;
+        int64_t iconUs = 0;
+
+        static void renderTask(void *arg);
+        static void refreshTimer(void *arg);
+        static void iconDrawEvent(lv_event_t *e);
+        void watchIcon(lv_obj_t *img);
+        time_t nextChange(time_t now);
+        time_t scheduleRefresh(time_t now);
+        void render();
+        void renderAhead();
+        bool drawFrame(time_t when);
+        bool drawLite();
+        void loadAssets();
         void createUi();
-        void updateUi();
+        bool updateUi(time_t now);
+        void collectionTimes(time_t now, Bins bins[3], time_t times[3]);
         void drawRow(Bins bin, uint8_t row, time_t when);
 };
 
@@ -3,33 +3,136 @@
 #include "../config.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_sleep.h"
+#include "esp_rom_crc.h"
+#include "esp_task_wdt.h"
 #include "driver/gpio.h"
 
+#include <algorithm>
+#include <array>
+
 static const char *TAG = "EPAPER";
-BDEpaper epaper;
 
+// RGB565 to luma, one table per channel in 16.16 fixed point so a pixel
+// costs three loads and no divide. Channels are expanded like LVGL does,
+// which keeps white at exactly 255. Entries are rounded up, so the sum
+// truncates to (r * 299 + g * 587 + b * 114) / 1000 for every colour, the
+// formula the conversion has always used (tools/bench checks all 65536).
+template <int Bits>
+static constexpr std::array<uint32_t, 1 << Bits> luma_table(uint32_t weight) {
+    std::array<uint32_t, 1 << Bits> t{};
+    for (int i = 0; i < (1 << Bits); i++) {
+        uint64_t v = Bits == 5 ? (i << 3) | (i >> 2) : (i << 2) | (i >> 4);
+        t[i] = (v * weight * 65536 + 999) / 1000;
+    }
+    return t;
+}
+
+static constexpr auto luma_r = luma_table<5>(299);
+static constexpr auto luma_g = luma_table<6>(587);
+static constexpr auto luma_b = luma_table<5>(114);
+
+static inline uint8_t luma565(uint16_t c) {
+    return (luma_r[c >> 11] + luma_g[(c >> 5) & 0x3F] + luma_b[c & 0x1F]) >> 16;
+}
+
+// RGB565 to RGB888, the low bits repeating the high ones so white stays 255
+static inline void expand565(uint16_t c, uint8_t *p) {
+    uint8_t r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+    p[0] = (r << 3) | (r >> 2);
+    p[1] = (g << 2) | (g >> 4);
+    p[2] = (b << 3) | (b >> 2);
+}
+
+// Saturated red for KWR panels: strong red channel, weak green and blue
+static inline bool red565(uint16_t c) {
+    // Bitwise so the per-pixel loops stay free of branches
+    return (c >= 0x8000) & ((c & 0x07E0) < 0x0400) & ((c & 0x001F) < 0x0010);
+}
+
+// Ordered dither thresholds, white where luma is above the entry. Pure
+// black and white map to themselves so icons and text stay crisp.
+static const uint8_t bayer8[8][8] = {
+    {  2, 130,  34, 162,  10, 138,  42, 170},
+    {194,  66, 226,  98, 202,  74, 234, 106},
+    { 50, 178,  18, 146,  58, 186,  26, 154},
+    {242, 114, 210,  82, 250, 122, 218,  90},
+    { 14, 142,  46, 174,   6, 134,  38, 166},
+    {206,  78, 238, 110, 198,  70, 230, 102},
+    { 62, 190,  30, 158,  54, 182,  22, 150},
+    {254, 126, 222,  94, 246, 118, 214,  86},
+};
+
+// Panel colours in EPD_PIXEL_* order
 static const struct {
     uint8_t r, g, b;
     uint8_t epaper_color;
-} bw_palette[] = {
+} palette[] = {
     {0,   0,   0,   EPD_PIXEL_BLACK},
     {255, 255, 255, EPD_PIXEL_WHITE},
+    {255, 255, 0,   EPD_PIXEL_YELLOW},
+    {255, 0,   0,   EPD_PIXEL_RED},
+    {255, 128, 0,   EPD_PIXEL_ORANGE},
+    {0,   0,   255, EPD_PIXEL_BLUE},
+    {0,   255, 0,   EPD_PIXEL_GREEN},
+};
+
+static const char *dither_names[] = {"threshold", "bayer", "diffusion", "auto"};
+
+// Panel scripts: command byte, data length, data bytes
+static const uint8_t refresh_script[] = {
+    E_CMD_AUTO, 1, AUTO_SEQUENCE_PON_DRF_POF
+};
+
+static const uint8_t sleep_script[] = {
+    E_CMD_DEEP_SLEEP, 0
 };
 
 static inline int clamp_byte(int v) {
     return v < 0 ? 0 : (v > 255 ? 255 : v);
 }
 
+// Adds weight/16 of each channel's error, like the RGB888 kernel always did
+static inline void spread(uint8_t *p, const int err[3], int weight) {
+    for (int k = 0; k < 3; k++) {
+        p[k] = clamp_byte(p[k] + err[k] * weight / 16);
+    }
+}
+
+// Black or white in every channel, so quantizing it leaves no error
+static inline bool pure888(const uint8_t *p) {
+    return (p[0] & p[1] & p[2]) == 255 || (p[0] | p[1] | p[2]) == 0;
+}
+
+static void IRAM_ATTR spiPreTransfer(spi_transaction_t *t) {
+    gpio_set_level(E_DC_PIN, t->user != NULL);
+}
+
+static void IRAM_ATTR busyISR(void *arg) {
+    ((BDPanel*) arg)->busyReady();
+}
+
+template <class Display>
 static void lvgl_flush_cb(lv_display_t *disp, const lv_area_t *area, uint8_t *color_p) {
-    BDEpaper* ctx = (BDEpaper*) lv_display_get_user_data(disp);
+    Display* ctx = (Display*) lv_display_get_user_data(disp);
     ctx->flush(disp, area, color_p);
 }
 
-static inline uint32_t calc_buffer_size(uint16_t w, uint16_t h, uint8_t bpp) {
-    return ((uint32_t)w * h * bpp + 7) / 8;
+template <class Display>
+static void lvgl_render_start_cb(lv_event_t *e) {
+    Display* ctx = (Display*) lv_event_get_user_data(e);
+    ctx->renderStart();
 }
 
-BDEpaper::BDEpaper() {
+template <class Display>
+static void lvgl_invalidate_cb(lv_event_t *e) {
+    Display* ctx = (Display*) lv_event_get_user_data(e);
+    ctx->invalidate((lv_area_t*) lv_event_get_param(e));
+}
+
+BDPanel::BDPanel() {
     panelSettings = {
         .softReset = NO_SOFT_RESET,
         .booster = BOOSTER_ON,
@@ -46,98 +149,409 @@ BDEpaper::BDEpaper() {
         .vcmz = VCMZ_NO_EFFECT,
         .reserved = 0
     };
+}
 
-    buffer_size = calc_buffer_size(DISPLAY_X, DISPLAY_Y, DISPLAY_B); // 12480
-    framebuffer = (uint8_t*) malloc(buffer_size);
-    if (!framebuffer) printf("Failed to allocate framebuffer %lu\n", buffer_size);
-    memset(framebuffer, 0xFF, buffer_size);
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+BDEpaper<Width, Height, Bpp, Rotation, Kwr>::BDEpaper() {
+    // Mirrored orientations come from the scan order, not the framebuffer
+    panelSettings.horizontalScanDir = (Rotation == 90 || Rotation == 180) ? HSCAN_LEFT : HSCAN_RIGHT;
+    panelSettings.verticalScanDir = (Rotation == 180 || Rotation == 270) ? VSCAN_UP : VSCAN_DOWN;
+    panelSettings.kwr = Kwr ? BLACK_WHITE_RED : BLACK_WHITE;
+
+    // The framebuffer only exists while a frame renders or waits to be
+    // shown, see reserveArena
+    buffer_size = BufferSize; // 12480
+    framebuffer = NULL;
+
+    // Red plane, sent as DTM2 in place of the new black/white frame. Kept,
+    // as the last frame only holds black and white to restore from
+    redbuffer = NULL;
+    if (Kwr) {
+        redbuffer = (uint8_t*) heap_caps_malloc(buffer_size, MALLOC_CAP_DMA);
+        if (!redbuffer) printf("Failed to allocate redbuffer %lu\n", buffer_size);
+        memset(redbuffer, 0xFF, buffer_size);
+    }
 
-    // Allocate lvgl buffer
-    uint32_t partial_lines = 10;
-    lvgl_buf_size = DISPLAY_X * partial_lines * sizeof(uint16_t); // 8320
-    lvgl_buf = (uint8_t*) malloc(lvgl_buf_size);
-    if (!lvgl_buf) printf("Failed to allocate lvgl_buf %lu\n", lvgl_buf_size);
+    // Last frame committed to the panel, diffed against for partial refresh
+    // and copied into the framebuffer for renders that patch areas
+    lastframe = (uint8_t*) heap_caps_malloc(buffer_size, MALLOC_CAP_DMA);
+    if (!lastframe) printf("Failed to allocate lastframe %lu\n", buffer_size);
+    lastframe_valid = false;
+    partial_count = 0;
+    frame_hash = 0;
+    skip_count = 0;
+
+    // LVGL's draw buffer, the dither rows and the stream slots only exist
+    // while a frame renders, see reserveArena
+    arena = NULL;
+    scratch = NULL;
+    lvgl_disp = NULL;
+    lvgl_buf = NULL;
+    lvgl_buf_size = LvglBufSize; // 8320, 4168 for I1
     partial_render_mode = true;
-
-    // Allocate buffer for dithering
-    size_t rgb_buf_size = DISPLAY_X * DISPLAY_Y * 3; // 299,520
-    rgb_buf = (uint8_t*) malloc(rgb_buf_size);
-    if (!rgb_buf) printf("Failed to allocate rgb_buf %u\n", rgb_buf_size);
-    memset(rgb_buf, 0xFF, rgb_buf_size);
+    dither_rows = NULL;
+    dither_mode = DISPLAY_DITHER;
+    streaming = false;
+    stream_slot = 0;
+    stream_slots = NULL;
+
+    invalidated = { X, Y, -1, -1 };
+    full_frame = false;
+    rendering_ahead = false;
+    ahead_valid = false;
+    dirty = { 0, (uint16_t) (Cols - 1), 0, (uint16_t) (Width - 1) };
+    render_start = 0;
+    render_cpu = 0;
+    slice_start = 0;
+    sleep_start = 0;
+    yield_us = 0;
+    wdt_added = false;
 }
 
-void BDEpaper::panelWrite(const uint8_t *data, uint32_t len) {
+void BDPanel::panelWrite(const uint8_t *old, const uint8_t *data, uint32_t len) {
+    // DTM1 is the old plane, always written as a reset leaves it undefined
     spiC(E_CMD_DATA_TRASMISSION);
-    spiBulk(data, len);
+    spiBulk(old, len);
 
     spiC(E_CMD_DATA_TRASMISSION_2);
     spiBulk(data, len);
 }
 
-void BDEpaper::panelUpdate() {
-    spiC(E_CMD_AUTO);
-    spiD(AUTO_SEQUENCE_PON_DRF_POF);
-    wait();
+// PARTIAL_WINDOW parameters for a window, horizontal bounds in pixels
+// and byte aligned as the controller requires
+static void encodeWindow(const PanelWindow &win, uint8_t out[PANEL_WINDOW_BYTES]) {
+    uint16_t hStart = win.colStart * 8;
+    uint16_t hEnd = win.colEnd * 8 + 7;
+    const uint8_t params[PANEL_WINDOW_BYTES] = {
+        (uint8_t) (hStart >> 8), (uint8_t) (hStart & 0xF8),
+        (uint8_t) (hEnd >> 8), (uint8_t) (hEnd | 0x07),
+        (uint8_t) (win.lineStart >> 8), (uint8_t) win.lineStart,
+        (uint8_t) (win.lineEnd >> 8), (uint8_t) win.lineEnd,
+        PT_SCAN_ALL
+    };
+    memcpy(out, params, PANEL_WINDOW_BYTES);
+}
+
+void BDPanel::panelWriteWindow(const uint8_t *old, const uint8_t *data, uint16_t cols, const PanelWindow &win) {
+    // Queued without waiting, spiWindow below waits before this returns
+    uint8_t window[PANEL_WINDOW_BYTES];
+    encodeWindow(win, window);
 
-    spiC(E_CMD_DEEP_SLEEP);
-    wait();
+    spiC(E_CMD_PARTIAL_ENTER);
+    spiC(E_CMD_PARTIAL_WINDOW);
+    spiQueue(window, sizeof(window), true);
+    spiC(E_CMD_DATA_TRASMISSION);
+    spiWindow(old, cols, win);
+
+    spiC(E_CMD_DATA_TRASMISSION_2);
+    spiWindow(data, cols, win);
+}
+
+void BDPanel::panelUpdate() {
+    spiScript(refresh_script, sizeof(refresh_script));
+    wait(BUSY_REFRESH);
+}
+
+void BDPanel::panelSleep() {
+    spiScript(sleep_script, sizeof(sleep_script));
+    wait(BUSY_SLEEP);
 
     gpio_set_level(HV_CTL_PIN, 0);
     pwrState = false;
 }
 
-void BDEpaper::power() {
-    panelInit();
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+bool BDEpaper<Width, Height, Bpp, Rotation, Kwr>::findWindow(PanelWindow &win) {
+    const uint16_t cols = Cols;
+
+    // Byte columns hold whole pixels only on 1-bpp panels, and neither
+    // colour nor KWR panels have a partial waveform anyway
+    if constexpr (Bpp != 1 || Kwr) return false;
+
+    // Only the areas LVGL redrew can differ from the last frame
+    uint16_t span = dirty.colEnd - dirty.colStart + 1;
+    win = { cols, 0, Width, 0 };
+    for (uint16_t line = dirty.lineStart; line <= dirty.lineEnd; line++) {
+        const uint8_t *a = framebuffer + line * cols;
+        const uint8_t *b = lastframe + line * cols;
+        if (!memcmp(a + dirty.colStart, b + dirty.colStart, span)) continue;
+
+        win.lineStart = std::min(win.lineStart, line);
+        win.lineEnd = line;
+        for (uint16_t col = dirty.colStart; col <= dirty.colEnd; col++) {
+            if (a[col] != b[col]) {
+                win.colStart = std::min(win.colStart, col);
+                win.colEnd = std::max(win.colEnd, col);
+            }
+        }
+    }
+
+    return win.lineStart <= win.lineEnd;
 }
 
-void BDEpaper::flushDisplay() {
-    panelWrite(framebuffer, buffer_size);
-    panelUpdate();
-    ESP_LOGI(TAG, "Panel update complete");
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::streamWindow(const PanelWindow &win, uint8_t *script, const uint8_t *bw, const uint8_t *red, uint32_t len) {
+    // Queued without waiting, so the window data must outlive this call
+    encodeWindow(win, script);
+
+    spiC(E_CMD_PARTIAL_ENTER);
+    spiC(E_CMD_PARTIAL_WINDOW);
+    spiQueue(script, PANEL_WINDOW_BYTES, true);
+    // Streamed frames get a full refresh, which also needs the old plane
+    // written after the reset, see flushDisplay
+    spiC(E_CMD_DATA_TRASMISSION);
+    spiQueueBulk(bw, len);
+    spiC(E_CMD_DATA_TRASMISSION_2);
+    spiQueueBulk(Kwr ? red : bw, len);
+    spiC(E_CMD_PARTIAL_EXIT);
 }
 
-void BDEpaper::flush(lv_display_t *disp, const lv_area_t *area, uint8_t *color_p) {
-    uint16_t *buffer = (uint16_t *)color_p;
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::streamBands() {
+    // A band queues 8 transactions at least: partial enter, the window
+    // command and its data, both planes with one or more chunks each, and
+    // partial exit. A slot is refilled two bands later, when its exit and
+    // the other band's 8 are queued behind its last chunk, and only the
+    // newest SPI_QUEUE_SIZE transactions can still be in flight.
+    static_assert(SPI_QUEUE_SIZE <= 1 + 8, "stream slots would be reused while queued");
+
+    if constexpr (Portrait) {
+        // Finished rows are whole gate lines, already contiguous in the framebuffer
+        if (rows_done == rows_sent) return;
+        PanelWindow win = { 0, Cols - 1, rows_sent, (uint16_t) (rows_done - 1) };
+        uint32_t offset = rows_sent * Cols;
+        uint8_t *slot = stream_slots + stream_slot * SlotSize;
+        streamWindow(win, slot, framebuffer + offset, Kwr ? redbuffer + offset : NULL, (rows_done - rows_sent) * Cols);
+        stream_slot ^= 1;
+        rows_sent = rows_done;
+        return;
+    }
 
-    // Store RGB888 in buffer for dithering
-    for (int y = area->y1; y <= area->y2; y++) {
-        for (int x = area->x1; x <= area->x2; x++) {
-            // RGB565 to RGB888 with proper bit expansion
-            // This ensures white (31,63,31) -> (255,255,255)
-            uint16_t c = *buffer++;
-            uint8_t r5 = (c >> 11) & 0x1F;
-            uint8_t g6 = (c >> 5) & 0x3F;
-            uint8_t b5 = c & 0x1F;
-            uint8_t r = (r5 << 3) | (r5 >> 2);  // 5-bit to 8-bit
-            uint8_t g = (g6 << 2) | (g6 >> 4);  // 6-bit to 8-bit
-            uint8_t b = (b5 << 3) | (b5 >> 2);  // 5-bit to 8-bit
-
-            int idx = (y * DISPLAY_X + x) * 3;
-            rgb_buf[idx + 0] = r;
-            rgb_buf[idx + 1] = g;
-            rgb_buf[idx + 2] = b;
+    // Each group of 8 finished rows is one byte column across all gate
+    // lines, gathered into a slot as the panel expects it line by line
+    while (rows_sent + 8 <= rows_done) {
+        uint16_t col = rows_sent / 8;
+        uint8_t *slot = stream_slots + stream_slot * SlotSize;
+        uint8_t *bw = slot + 16;
+        uint8_t *red = bw + Width;
+        for (uint16_t line = 0; line < Width; line++) {
+            bw[line] = framebuffer[line * Cols + col];
+            if (Kwr) red[line] = redbuffer[line * Cols + col];
         }
-        // Yield periodically
-        if ((y % 50) == 0) {
-            vTaskDelay(1);
+
+        PanelWindow win = { col, col, 0, Width - 1 };
+        streamWindow(win, slot, bw, red, Width);
+        stream_slot ^= 1;
+        rows_sent += 8;
+    }
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::flushDisplay() {
+    PanelWindow win;
+    spi_us = 0;
+
+    bool streamed = streaming;
+    streaming = false;
+    if (streamed) spiWait();
+
+    // The hash survives reboots, so an unchanged first frame is skipped too
+    uint32_t hash = esp_rom_crc32_le(0, framebuffer, buffer_size);
+    if constexpr (Kwr) hash = esp_rom_crc32_le(hash, redbuffer, buffer_size);
+    if (hash == frame_hash) {
+        skip_count++;
+        prefs.putUInt(NVS_SKIP_COUNT, skip_count);
+        ESP_LOGI(TAG, "Frame unchanged, skipping refresh (%lu skipped)", skip_count);
+        // The hash needs the whole frame, so a streamed one has already
+        // been sent and only the refresh is saved. Streaming is left to
+        // frames due a full refresh, see renderStart, where that is rare.
+        if (streamed) panelSleep();
+        if (!lastframe_valid) {
+            if (lastframe != framebuffer) memcpy(lastframe, framebuffer, buffer_size);
+            lastframe_valid = true;
         }
+        return;
     }
 
-    // Apply dithering after all pixels collected
-    bool is_last = (area->x2 == DISPLAY_X - 1) && (area->y2 == DISPLAY_Y - 1);
-    if (is_last) {
-        // Clear framebuffer first using bits_per_pixel from panel
-        uint8_t fill_byte;
-        if (DISPLAY_B == 4) {
-            fill_byte = (EPD_PIXEL_WHITE << 4) | EPD_PIXEL_WHITE;
-        } else if (DISPLAY_B == 2) {
-            fill_byte = 0x55;  // White (01) for all 4 pixels
+    if (streamed && rows_sent == Y) {
+        // Every band is already in panel RAM
+        ESP_LOGI(TAG, "Refresh starts %lld us after render start", esp_timer_get_time() - render_start);
+        panelUpdate();
+        partial_count = 0;
+        ESP_LOGI(TAG, "Panel full update complete, streamed");
+        panelSleep();
+        commitFrame(hash);
+        return;
+    }
+
+    bool full = streamed || !lastframe_valid || partial_count >= FULL_REFRESH_INTERVAL || !findWindow(win);
+
+    // The panel is only woken once there is something to send
+    if (!streamed) panelInit();
+
+    // A window covering most of the panel gains nothing over a full refresh
+    uint32_t win_size = full ? buffer_size : (win.colEnd - win.colStart + 1) * (win.lineEnd - win.lineStart + 1);
+    if (full || win_size > buffer_size / 2) {
+        // The panel is reset before every refresh, so its old plane holds
+        // whatever power-up left there. The new frame goes in as the old one
+        // too, as before partial refreshes, KWR panels take black/white as
+        // DTM1 and red as DTM2 instead.
+        if constexpr (Kwr) {
+            panelWrite(framebuffer, redbuffer, buffer_size);
         } else {
-            fill_byte = 0xFF;  // 1-bit white
+            panelWrite(framebuffer, framebuffer, buffer_size);
         }
-        memset(framebuffer, fill_byte, buffer_size);
+        panelUpdate();
+        partial_count = 0;
+        ESP_LOGI(TAG, "Panel full update complete, SPI %lld us", spi_us);
+    } else {
+        panelWriteWindow(lastframe, framebuffer, Cols, win);
+        panelUpdate();
+        spiC(E_CMD_PARTIAL_EXIT);
+        partial_count++;
+        ESP_LOGI(TAG, "Panel partial update complete, lines %u-%u cols %u-%u (%lu bytes), SPI %lld us",
+            win.lineStart, win.lineEnd, win.colStart, win.colEnd, win_size, spi_us);
+    }
+    panelSleep();
+    commitFrame(hash);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::commitFrame(uint32_t hash) {
+    // Nothing to copy when the frame was patched into the last one in place
+    if (lastframe != framebuffer) memcpy(lastframe, framebuffer, buffer_size);
+    lastframe_valid = true;
+    frame_hash = hash;
+    prefs.putUInt(NVS_FRAME_HASH, frame_hash);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::renderStart() {
+    render_start = esp_timer_get_time();
+    slice_start = render_start;
+    sleep_start = render_start;
+    yield_us = 0;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    render_cpu = ulTaskGetRunTimeCounter(NULL);
+#endif
+    convert_us = 0;
+    diffused_rows = 0;
+
+    // Only a full screen arrives as whole rows from the top, which the
+    // streaming paths need. Anything less is patched into the last frame.
+    const lv_area_t &inv = invalidated;
+    full_frame = inv.x1 == 0 && inv.y1 == 0 && inv.x2 == X - 1 && inv.y2 == Y - 1;
+    uint16_t line1 = Portrait ? inv.y1 : inv.x1, line2 = Portrait ? inv.y2 : inv.x2;
+    uint16_t source1 = Portrait ? inv.x1 : inv.y1, source2 = Portrait ? inv.x2 : inv.y2;
+    dirty = {
+        (uint16_t) (source1 / PixelsPerByte), (uint16_t) (source2 / PixelsPerByte),
+        line1, line2
+    };
+    invalidated = { X, Y, -1, -1 };
+
+    if (full_frame) {
+        memset(framebuffer, FillByte, buffer_size);
+        if constexpr (Kwr) memset(redbuffer, 0xFF, buffer_size);
+    }
+
+    // A frame that will get a full refresh anyway is sent band by band
+    // while the rest renders. After a reboot the stored hash makes a
+    // skip likely, so the panel is left asleep until the end instead.
+    bool full = lastframe_valid ? partial_count >= FULL_REFRESH_INTERVAL : frame_hash == 0;
+    streaming = Bpp == 1 && full && full_frame && !rendering_ahead;
+    if (streaming) {
+        panelInit();
+        rows_done = 0;
+        rows_sent = 0;
+    }
 
-        applyDithering();
+    // Conversion never blocks, so the render task feeds the watchdog itself
+    // until the frame is handed to the panel
+    wdt_added = esp_task_wdt_status(NULL) == ESP_ERR_NOT_FOUND && esp_task_wdt_add(NULL) == ESP_OK;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::invalidate(lv_area_t *area) {
+    // Floyd-Steinberg carries error into every row below, so a diffused
+    // frame only comes out the same, and hashes the same, when rendered
+    // whole. LVGL then redraws the whole screen, the panel still only
+    // refreshes the window that changed. Ordered dithering has no such
+    // dependency, so those modes keep redrawing dirty areas alone.
+    if (Bpp == 1 && !DISPLAY_RENDER_I1 && (dither_mode == DITHER_DIFFUSION || dither_mode == DITHER_AUTO)) {
+        *area = { 0, 0, X - 1, Y - 1 };
+    }
+
+    invalidated.x1 = std::min(invalidated.x1, area->x1);
+    invalidated.y1 = std::min(invalidated.y1, area->y1);
+    invalidated.x2 = std::max(invalidated.x2, area->x2);
+    invalidated.y2 = std::max(invalidated.y2, area->y2);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::yieldIfDue() {
+    int64_t now = esp_timer_get_time();
+    if (now - slice_start < RENDER_SLICE_US) return;
+
+    if (wdt_added) esp_task_wdt_reset();
+    if (now - sleep_start < RENDER_SLEEP_US) {
+        taskYIELD();
+    } else {
+        // A tick can be 10 ms, sleep only this rarely so lower priority
+        // tasks run without stretching the render
+        vTaskDelay(1);
+        sleep_start = esp_timer_get_time();
+    }
+    slice_start = esp_timer_get_time();
+    yield_us += slice_start - now;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::flush(lv_display_t *disp, const lv_area_t *area, uint8_t *color_p) {
+    flushArea(area, color_p, lv_display_flush_is_last(disp));
+    lv_display_flush_ready(disp);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::flushArea(const lv_area_t *area, uint8_t *color_p, bool is_last) {
+    int64_t start = esp_timer_get_time();
+    int64_t yielded = yield_us;
+
+#if DISPLAY_RENDER_I1
+    // Skip the palette LVGL places in front of indexed buffers
+    convertI1(area, color_p + 8);
+#else
+    if constexpr (Bpp == 1) {
+        convertRgb565(area, (uint16_t *)color_p);
+    } else {
+        convertPalette(area, (uint16_t *)color_p);
+    }
+#endif
+
+    convert_us += esp_timer_get_time() - start - (yield_us - yielded);
+    if (streaming) streamBands();
+    yieldIfDue();
+
+    if (is_last) {
+#if DISPLAY_RENDER_I1
+        ESP_LOGI(TAG, "Frame converted in %lld us", convert_us);
+#else
+        ESP_LOGI(TAG, "Frame converted in %lld us, %s dither, %u rows diffused",
+            convert_us, dither_names[dither_mode], diffused_rows);
+#endif
+
+        int64_t wall = esp_timer_get_time() - render_start;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        int64_t cpu = (uint32_t) (ulTaskGetRunTimeCounter(NULL) - render_cpu);
+#else
+        int64_t cpu = wall - yield_us;
+#endif
+        ESP_LOGI(TAG, "Render wall %lld us, CPU %lld us, %lld us yielded", wall, cpu, yield_us);
+
+        // Waiting for BUSY may take longer than the watchdog timeout
+        if (wdt_added) {
+            esp_task_wdt_delete(NULL);
+            wdt_added = false;
+        }
     }
 
     // Mark framebuffer as dirty
@@ -146,100 +560,498 @@ void BDEpaper::flush(lv_display_t *disp, const lv_area_t *area, uint8_t *color_p
     // Only update display when:
     // 1. Full render mode (not partial) - update every flush
     // 2. Partial render mode - only update on last chunk
-    if (!partial_render_mode || is_last) {
+    if (rendering_ahead) {
+        if (is_last) ESP_LOGI(TAG, "Frame kept for the next scheduled refresh");
+        ahead_valid = ahead_valid || is_last;
+    } else if (!partial_render_mode || is_last) {
         // Update display
         flushDisplay();
         fb_dirty = false;
     }
+}
 
-    lv_display_flush_ready(disp);
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::renderAhead(bool enable) {
+    if (enable) ahead_valid = false;
+    rendering_ahead = enable;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+bool BDEpaper<Width, Height, Bpp, Rotation, Kwr>::showAhead() {
+    // Nothing was flushed when the frame ahead matched the one on the panel
+    if (!ahead_valid) {
+        releaseFrame();
+        return false;
+    }
+
+    ahead_valid = false;
+    flushDisplay();
+    fb_dirty = false;
+    releaseFrame();
+    return true;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+bool BDEpaper<Width, Height, Bpp, Rotation, Kwr>::dropAhead() {
+    // When a frame was dropped the framebuffer no longer matches the panel,
+    // so the caller has to redraw the whole screen before patching areas again
+    bool dropped = ahead_valid;
+    ahead_valid = false;
+    releaseFrame();
+    return dropped;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+uint8_t* BDEpaper<Width, Height, Bpp, Rotation, Kwr>::renderBuffer(uint32_t &size) {
+    size = lvgl_buf_size;
+    return lvgl_buf;
 }
 
-static uint8_t find_nearest_color_idx(int r, int g, int b) {
-    // BW mode: simple threshold
-    int gray = (r * 299 + g * 587 + b * 114) / 1000;
-    return (gray < 128) ? 0 : 1;  // 0=black, 1=white
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::carveScratch(uint8_t *base, uint32_t lvgl_size) {
+    scratch = base;
+    // LVGL's draw buffer first, 4-byte aligned like the block itself
+    lvgl_buf = base;
+    lvgl_buf_size = lvgl_size;
+    // Two slots of window parameters and gathered band data for streaming
+    stream_slots = base + ((lvgl_size + 3) & ~3);
+    // Two RGB888 rows for streaming dithering, the row being quantized
+    // and the row below it which receives the diffused error
+    dither_rows = stream_slots + ((2 * SlotSize + 3) & ~3);
 }
 
-static inline void set_fb_pixel(uint8_t *fb, int y, int x, int width, uint8_t color)
-{
-    // 1-bit per pixel (BW)
-    uint16_t byte_idx = y * (width / 8) + (x / 8);
-    uint8_t bit = 7 - (x % 8);
-    if (color == EPD_PIXEL_WHITE) {
-        fb[byte_idx] |= (1 << bit);
+// Returns false when the last frame could not be restored into the
+// framebuffer, the caller then has to redraw the whole screen
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+bool BDEpaper<Width, Height, Bpp, Rotation, Kwr>::reserveArena() {
+    if (scratch) return true;
+    arena_start = esp_timer_get_time();
+
+    // A frame still kept ahead is superseded by this render
+    releaseFrame();
+
+    // One block taken and given back whole, so renders leave no holes
+    // between the Zigbee stack's allocations
+    bool restored = lastframe_valid;
+    arena = (uint8_t*) heap_caps_malloc(ArenaSize, MALLOC_CAP_DMA);
+    if (arena) {
+        framebuffer = arena;
+        carveScratch(arena + BufferSize, LvglBufSize);
+        // Areas LVGL redraws are patched into the frame on the panel
+        if (restored) memcpy(framebuffer, lastframe, buffer_size);
     } else {
-        fb[byte_idx] &= ~(1 << bit);
+        // Rendering cannot fail for want of a block: the frame is patched
+        // into the last one in place, with scratch from the static reserve.
+        // Without the old frame to diff against, it gets a full refresh.
+        ESP_LOGW(TAG, "No %lu byte block for the render arena (largest %u), "
+            "rendering into the last frame with %lu reserved bytes, this frame gets a full refresh",
+            ArenaSize, heap_caps_get_largest_free_block(MALLOC_CAP_DMA), ReserveSize);
+        framebuffer = lastframe;
+        lastframe_valid = false;
+        carveScratch(reserve, ReserveBufSize);
     }
+    if (!restored) memset(framebuffer, FillByte, buffer_size);
+
+#if DISPLAY_LITE != 1
+    if (lvgl_disp) lv_display_set_buffers(lvgl_disp, lvgl_buf, NULL, lvgl_buf_size, LV_DISPLAY_RENDER_MODE_PARTIAL);
+#endif
+    return restored;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::releaseArena() {
+    if (!scratch) return;
+
+#if DISPLAY_LITE != 1
+    // LVGL only refreshes from drawFrame, between reserve and release, and
+    // is left without a buffer pointing into the memory given back below
+    if (lvgl_disp) lv_display_set_draw_buffers(lvgl_disp, NULL, NULL);
+#endif
+    bool reserved = scratch == reserve;
+    scratch = NULL;
+    lvgl_buf = NULL;
+    stream_slots = NULL;
+    dither_rows = NULL;
+
+    if (!ahead_valid) {
+        releaseFrame();
+    } else if (arena) {
+        // The frame waits for its refresh, only the scratch is given back.
+        // Shrinking keeps the block where it is, the framebuffer comes first.
+        uint8_t *kept = (uint8_t*) heap_caps_realloc(arena, BufferSize, MALLOC_CAP_DMA);
+        if (kept) arena = framebuffer = kept;
+    }
+
+    // The heap only reports its all-time low, so the figure for buffers
+    // held for good is an estimate: the arena's size off that low
+    size_t low = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    ESP_LOGI(TAG, "Render arena of %lu bytes%s held %lld us, heap low water %u bytes, "
+        "estimated %u with permanent buffers", reserved ? ReserveSize : ArenaSize, reserved ? " (reserve)" : "",
+        esp_timer_get_time() - arena_start, low, low > ArenaSize ? low - ArenaSize : 0);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::releaseFrame() {
+    if (arena) heap_caps_free(arena);
+    arena = NULL;
+    framebuffer = NULL;
 }
 
-void BDEpaper::applyDithering() {
-    for (int y = 0; y < DISPLAY_Y; y++) {
-        // Yield every 20 rows to prevent watchdog
-        if (y % 20 == 0) {
-            vTaskDelay(1);
+#if DISPLAY_LITE == 2
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+bool BDEpaper<Width, Height, Bpp, Rotation, Kwr>::checkStart() {
+    // The frame in the framebuffer is the reference, the next render is
+    // kept like a frame ahead so nothing reaches the panel
+    check_frame = (uint8_t*) malloc(buffer_size);
+    if (!check_frame) return false;
+    memcpy(check_frame, framebuffer, buffer_size);
+    check_ahead[0] = rendering_ahead;
+    check_ahead[1] = ahead_valid;
+    rendering_ahead = true;
+    return true;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+uint32_t BDEpaper<Width, Height, Bpp, Rotation, Kwr>::checkEnd() {
+    uint32_t diff = 0;
+    int first = -1;
+    for (uint32_t i = 0; i < buffer_size; i++) {
+        uint8_t bits = framebuffer[i] ^ check_frame[i];
+        if (bits && first < 0) first = i;
+        diff += __builtin_popcount(bits);
+    }
+    if (diff) {
+        ESP_LOGW(TAG, "Frames differ in %lu pixels, first at line %d byte %d",
+            diff, first / Cols, first % Cols);
+    } else {
+        ESP_LOGI(TAG, "Frames identical");
+    }
+
+    memcpy(framebuffer, check_frame, buffer_size);
+    free(check_frame);
+    check_frame = NULL;
+    rendering_ahead = check_ahead[0];
+    ahead_valid = check_ahead[1];
+    return diff;
+}
+#endif
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::ditherRow(int y, uint8_t *row, uint8_t *next) {
+    uint8_t *out = rowBits(y);
+    uint32_t bits = 0;
+
+    if (!dither_grey[y & 1]) {
+        // Only pure black and white, diffusion would find no error to spread
+        for (int x = 0; x < X; x++) {
+            bits = (bits << 1) | (row[x * 3] >> 7);
+            if ((x & 7) == 7) out[x >> 3] = bits;
         }
+        storeRow(y);
+        return;
+    }
+
+    diffused_rows++;
+    for (int x = 0; x < X; x++) {
+        // Threshold the luma, 1 = white. Compared undivided, the same as
+        // (r * 299 + g * 587 + b * 114) / 1000 >= 128
+        uint8_t *p = row + x * 3;
+        int white = p[0] * 299 + p[1] * 587 + p[2] * 114 >= 128 * 1000;
+        int level = white ? 255 : 0;
+        int err[3] = { p[0] - level, p[1] - level, p[2] - level };
+        bits = (bits << 1) | white;
+        if ((x & 7) == 7) out[x >> 3] = bits;
+        // Pure pixels between the greys have nothing to spread
+        if (!(err[0] | err[1] | err[2])) continue;
+
+        // Distribute each channel's error to neighbors (Floyd-Steinberg)
+        // Right pixel: 7/16
+        if (x + 1 < X) {
+            spread(p + 3, err, 7);
+        }
+        if (!next) continue;
+
+        uint8_t *q = next + x * 3;
+        // Bottom-left pixel: 3/16
+        if (x > 0) {
+            spread(q - 3, err, 3);
+        }
+        // Bottom pixel: 5/16
+        spread(q, err, 5);
+        // Bottom-right pixel: 1/16
+        if (x + 1 < X) {
+            spread(q + 3, err, 1);
+        }
+    }
+    if (!next || dither_mode == DITHER_DIFFUSION) {
+        storeRow(y);
+        return;
+    }
+
+    // Error below usually dies out against clamping within a few rows
+    bool grey = false;
+    for (int x = 0; x < X; x++) {
+        grey |= !pure888(next + x * 3);
+    }
+    dither_grey[(y + 1) & 1] = grey;
+
+    storeRow(y);
+}
+
+// Transpose an 8x8 bit block, MSB first. Byte i of the input holds row i,
+// byte j of the output holds column j (Hacker's Delight, transpose8).
+static inline void transpose8(const uint8_t *in, int in_stride, uint8_t *out, int out_stride) {
+    // Widened before shifting, a byte promotes to int and bit 7 would land in the sign bit
+    uint32_t a = ((uint32_t) in[0] << 24) | ((uint32_t) in[in_stride] << 16) | ((uint32_t) in[2 * in_stride] << 8) | in[3 * in_stride];
+    uint32_t b = ((uint32_t) in[4 * in_stride] << 24) | ((uint32_t) in[5 * in_stride] << 16) | ((uint32_t) in[6 * in_stride] << 8) | in[7 * in_stride];
+    uint32_t t;
+
+    t = (a ^ (a >> 7)) & 0x00AA00AA; a = a ^ t ^ (t << 7);
+    t = (b ^ (b >> 7)) & 0x00AA00AA; b = b ^ t ^ (t << 7);
+    t = (a ^ (a >> 14)) & 0x0000CCCC; a = a ^ t ^ (t << 14);
+    t = (b ^ (b >> 14)) & 0x0000CCCC; b = b ^ t ^ (t << 14);
+    t = (a & 0xF0F0F0F0) | ((b >> 4) & 0x0F0F0F0F);
+    b = ((a << 4) & 0xF0F0F0F0) | (b & 0x0F0F0F0F);
+    a = t;
+
+    out[0] = a >> 24; out[out_stride] = a >> 16; out[2 * out_stride] = a >> 8; out[3 * out_stride] = a;
+    out[4 * out_stride] = b >> 24; out[5 * out_stride] = b >> 16; out[6 * out_stride] = b >> 8; out[7 * out_stride] = b;
+}
+
+// Bits first to last of a byte, MSB first, clipped to the byte
+static inline uint8_t spanMask(int first, int last) {
+    return (0xFF >> std::max(first, 0)) & (0xFF << (7 - std::min(last, 7)));
+}
+
+// Eight pixels of a packed row from pixel i on, MSB first. Pixels before
+// the row start read as 0, as do those past its stride.
+static inline uint8_t packedByte(const uint8_t *row, int i, uint32_t stride) {
+    if (i < 0) return row[0] >> -i;
+    uint32_t at = i >> 3;
+    uint16_t w = row[at] << 8;
+    if ((i & 7) && at + 1 < stride) w |= row[at + 1];
+    return w >> (8 - (i & 7));
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+uint8_t* BDEpaper<Width, Height, Bpp, Rotation, Kwr>::rowBits(int y, FramePlane plane) {
+    if constexpr (Portrait) {
+        // Display rows are gate lines, packed rows go straight to the framebuffer
+        return (plane == PLANE_RED ? redbuffer : framebuffer) + y * Cols;
+    }
+    return row_tile[Kwr ? plane : 0][y & 7];
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::storeRow(int y, FramePlane plane) {
+    if (plane == PLANE_BW) rows_done = y + 1;
+
+    // Display columns are gate lines, so each block of 8 packed rows is
+    // transposed into 8 whole framebuffer bytes, one per line
+    if (Portrait || (y & 7) != 7) return;
 
-        for (int x = 0; x < DISPLAY_X; x++) {
-            int idx = (y * DISPLAY_X + x) * 3;
-
-            // Get current pixel RGB
-            int r = rgb_buf[idx + 0];
-            int g = rgb_buf[idx + 1];
-            int b = rgb_buf[idx + 2];
-
-            // Find nearest palette color
-            uint8_t pal_idx = find_nearest_color_idx(r, g, b);
-            uint8_t epaper_color;
-            int pal_r, pal_g, pal_b;
-
-            epaper_color = (pal_idx == 0) ? EPD_PIXEL_BLACK : EPD_PIXEL_WHITE;
-            pal_r = bw_palette[pal_idx].r;
-            pal_g = bw_palette[pal_idx].g;
-            pal_b = bw_palette[pal_idx].b;
-
-            // Set pixel in framebuffer
-            set_fb_pixel(framebuffer, x, y, DISPLAY_Y, epaper_color);
-
-            // Calculate quantization error
-            int err_r = r - pal_r;
-            int err_g = g - pal_g;
-            int err_b = b - pal_b;
-
-            // Distribute error to neighbors (Floyd-Steinberg)
-            // Right pixel: 7/16
-            if (x + 1 < DISPLAY_X) {
-                int ni = idx + 3;
-                rgb_buf[ni + 0] = clamp_byte(rgb_buf[ni + 0] + err_r * 7 / 16);
-                rgb_buf[ni + 1] = clamp_byte(rgb_buf[ni + 1] + err_g * 7 / 16);
-                rgb_buf[ni + 2] = clamp_byte(rgb_buf[ni + 2] + err_b * 7 / 16);
+    uint8_t (*tile)[X / 8] = row_tile[Kwr ? plane : 0];
+    if (Kwr && plane == PLANE_RED && full_frame) {
+        // Whole frames start with no red, most blocks keep it that way
+        uint8_t all = 0xFF;
+        for (const uint8_t *p = &tile[0][0]; p < &tile[8][0]; p++) all &= *p;
+        if (all == 0xFF) return;
+    }
+    uint8_t *dst = (plane == PLANE_RED ? redbuffer : framebuffer) + (y >> 3);
+    for (int bx = 0; bx < X / 8; bx++) {
+        transpose8(&tile[0][bx], X / 8, dst + bx * 8 * Cols, Cols);
+    }
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::convertRgb565(const lv_area_t *area, const uint16_t *buffer) {
+    if (dither_mode == DITHER_THRESHOLD || dither_mode == DITHER_BAYER) {
+        quantizeRgb565(area, buffer);
+        return;
+    }
+
+    if (!full_frame) {
+        // Diffusing modes widen every invalidated area to the whole screen,
+        // so this only catches a switch from an ordered mode between
+        // invalidation and render. Those areas keep the ordered pattern.
+        quantizeRgb565(area, buffer);
+        return;
+    }
+
+    for (int y = area->y1; y <= area->y2; y++) {
+        uint8_t *next = dither_rows + (y & 1) * X * 3;
+        uint8_t *row = dither_rows + ((y + 1) & 1) * X * 3;
+
+        // Expand into the incoming row, channels scaled like LVGL does. Each
+        // channel carries its own error, as it always has, so dots land
+        // where they did before.
+        bool grey = false;
+        if constexpr (Kwr) {
+            // Red is settled here, it shows as white in the black/white plane
+            uint8_t *red = rowBits(y, PLANE_RED);
+            uint32_t bits = 0;
+            for (int x = 0; x < X; x++) {
+                uint16_t c = *buffer++;
+                bool is_red = red565(c);
+                bits = (bits << 1) | !is_red;
+                if ((x & 7) == 7) red[x >> 3] = bits;
+                uint8_t *p = next + x * 3;
+                if (is_red) {
+                    p[0] = p[1] = p[2] = 255;
+                } else {
+                    expand565(c, p);
+                    grey |= !pure888(p);
+                }
             }
-            // Bottom-left pixel: 3/16
-            if (y + 1 < DISPLAY_Y && x > 0) {
-                int ni = ((y + 1) * DISPLAY_X + x - 1) * 3;
-                rgb_buf[ni + 0] = clamp_byte(rgb_buf[ni + 0] + err_r * 3 / 16);
-                rgb_buf[ni + 1] = clamp_byte(rgb_buf[ni + 1] + err_g * 3 / 16);
-                rgb_buf[ni + 2] = clamp_byte(rgb_buf[ni + 2] + err_b * 3 / 16);
+            storeRow(y, PLANE_RED);
+        } else {
+            for (int x = 0; x < X; x++) {
+                uint8_t *p = next + x * 3;
+                expand565(*buffer++, p);
+                grey |= !pure888(p);
             }
-            // Bottom pixel: 5/16
-            if (y + 1 < DISPLAY_Y) {
-                int ni = ((y + 1) * DISPLAY_X + x) * 3;
-                rgb_buf[ni + 0] = clamp_byte(rgb_buf[ni + 0] + err_r * 5 / 16);
-                rgb_buf[ni + 1] = clamp_byte(rgb_buf[ni + 1] + err_g * 5 / 16);
-                rgb_buf[ni + 2] = clamp_byte(rgb_buf[ni + 2] + err_b * 5 / 16);
+        }
+        dither_grey[y & 1] = grey || dither_mode == DITHER_DIFFUSION;
+
+        // The row above now has its neighbour below, so it can be quantized
+        if (y > 0) {
+            ditherRow(y - 1, row, next);
+        }
+        if (y == Y - 1) {
+            ditherRow(y, next, NULL);
+        }
+
+        yieldIfDue();
+    }
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::setPixel(uint16_t x, uint16_t y, uint8_t color, FramePlane plane) {
+    // One framebuffer line per gate line, first source in the high bits
+    uint16_t line = Portrait ? y : x;
+    uint16_t source = Portrait ? x : y;
+    uint8_t shift = (PixelsPerByte - 1 - source % PixelsPerByte) * Bpp;
+    uint8_t mask = (1 << Bpp) - 1;
+
+    uint8_t *p = (plane == PLANE_RED ? redbuffer : framebuffer) + line * Cols + source / PixelsPerByte;
+    *p = (*p & ~(mask << shift)) | (color << shift);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::convertPalette(const lv_area_t *area, const uint16_t *buffer) {
+    // Colour panels take the nearest palette entry, 2-bpp panels use the first four
+    const int colors = Bpp == 2 ? 4 : 7;
+
+    for (int y = area->y1; y <= area->y2; y++) {
+        for (int x = area->x1; x <= area->x2; x++) {
+            uint16_t c = *buffer++;
+            int r = ((c >> 11) << 3) | (c >> 13);
+            int g = (((c >> 5) & 0x3F) << 2) | ((c >> 9) & 0x03);
+            int b = ((c & 0x1F) << 3) | ((c >> 2) & 0x07);
+
+            uint8_t best = EPD_PIXEL_WHITE;
+            int best_dist = INT32_MAX;
+            for (int i = 0; i < colors; i++) {
+                int dr = r - palette[i].r, dg = g - palette[i].g, db = b - palette[i].b;
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = palette[i].epaper_color;
+                }
+            }
+            setPixel(x, y, best);
+        }
+    }
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::quantizeRgb565(const lv_area_t *area, const uint16_t *buffer) {
+    // Each pixel depends only on its own value and position, so any area works
+    bool bayer = dither_mode != DITHER_THRESHOLD;
+
+    for (int y = area->y1; y <= area->y2; y++) {
+        const uint8_t *limit = bayer8[y & 7];
+        if (!full_frame) {
+            // Dirty areas are patched into the last frame pixel by pixel
+            for (int x = area->x1; x <= area->x2; x++) {
+                uint16_t c = *buffer++;
+                bool is_red = Kwr && red565(c);
+                uint8_t white = is_red || luma565(c) > (bayer ? limit[x & 7] : 127);
+                setPixel(x, y, white);
+                if (Kwr) setPixel(x, y, !is_red, PLANE_RED);
             }
-            // Bottom-right pixel: 1/16
-            if (y + 1 < DISPLAY_Y && x + 1 < DISPLAY_X) {
-                int ni = ((y + 1) * DISPLAY_X + x + 1) * 3;
-                rgb_buf[ni + 0] = clamp_byte(rgb_buf[ni + 0] + err_r / 16);
-                rgb_buf[ni + 1] = clamp_byte(rgb_buf[ni + 1] + err_g / 16);
-                rgb_buf[ni + 2] = clamp_byte(rgb_buf[ni + 2] + err_b / 16);
+            continue;
+        }
+
+        uint8_t *out = rowBits(y);
+        uint8_t *red = Kwr ? rowBits(y, PLANE_RED) : NULL;
+        uint32_t bits = 0, red_bits = 0;
+        for (int x = 0; x < X; x++) {
+            uint16_t c = *buffer++;
+            bool is_red = Kwr && red565(c);
+            bits = (bits << 1) | is_red | (luma565(c) > (bayer ? limit[x & 7] : 127));
+            red_bits = (red_bits << 1) | !is_red;
+            if ((x & 7) == 7) {
+                out[x >> 3] = bits;
+                if (Kwr) red[x >> 3] = red_bits;
             }
         }
+        storeRow(y);
+        if (Kwr) storeRow(y, PLANE_RED);
     }
 }
 
-esp_err_t BDEpaper::spiInit() {
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::convertI1(const lv_area_t *area, const uint8_t *bits) {
+    // LVGL has already thresholded to 1 = white, MSB first, so pixels only
+    // need moving into the rotated framebuffer
+    uint32_t stride = (area->x2 - area->x1 + 8) / 8;
+
+    if (full_frame) {
+        // Whole rows are already packed the way the output stage wants them
+        for (int y = area->y1; y <= area->y2; y++) {
+            memcpy(rowBits(y), bits, X / 8);
+            storeRow(y);
+            bits += stride;
+        }
+        return;
+    }
+
+    // Dirty areas are merged into the last frame a byte at a time
+    if constexpr (Portrait) {
+        for (int y = area->y1; y <= area->y2; y++) {
+            uint8_t *line = framebuffer + y * Cols;
+            for (int bx = area->x1 >> 3; bx <= area->x2 >> 3; bx++) {
+                uint8_t mask = spanMask(area->x1 - bx * 8, area->x2 - bx * 8);
+                line[bx] = (line[bx] & ~mask) | (packedByte(bits, bx * 8 - area->x1, stride) & mask);
+            }
+            bits += stride;
+        }
+        return;
+    }
+
+    // Display columns are gate lines, so the area is taken in 8x8 blocks
+    // and transposed like storeRow does for whole rows
+    for (int by = area->y1 >> 3; by <= area->y2 >> 3; by++) {
+        uint8_t rows = spanMask(area->y1 - by * 8, area->y2 - by * 8);
+        for (int bx = area->x1 >> 3; bx <= area->x2 >> 3; bx++) {
+            uint8_t block[8] = {}, lines[8];
+            for (int r = 0; r < 8; r++) {
+                if (rows & (0x80 >> r)) block[r] = packedByte(bits + (by * 8 + r - area->y1) * stride, bx * 8 - area->x1, stride);
+            }
+            transpose8(block, 1, lines, 1);
+
+            uint8_t columns = spanMask(area->x1 - bx * 8, area->x2 - bx * 8);
+            for (int j = 0; j < 8; j++) {
+                if (!(columns & (0x80 >> j))) continue;
+                uint8_t *p = framebuffer + (bx * 8 + j) * Cols + by;
+                *p = (*p & ~rows) | (lines[j] & rows);
+            }
+        }
+    }
+}
+
+esp_err_t BDPanel::spiInit() {
     gpio_config_t io_conf = {
         .pin_bit_mask = 0,
         .mode = GPIO_MODE_OUTPUT,
@@ -248,17 +1060,20 @@ esp_err_t BDEpaper::spiInit() {
         .intr_type = GPIO_INTR_DISABLE
     };
 
-    // DC, RST, CS as output
-    io_conf.pin_bit_mask = BIT(E_DC_PIN) | BIT(E_RST_PIN) | BIT(E_CS_PIN);
+    // DC, RST as output, CS is driven by the SPI peripheral
+    io_conf.pin_bit_mask = BIT(E_DC_PIN) | BIT(E_RST_PIN);
     gpio_config(&io_conf);
 
-    // BUSY as input
+    // BUSY as input, its interrupt is only enabled while waiting
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pin_bit_mask = BIT(E_BUSY_PIN);
+    io_conf.intr_type = GPIO_INTR_HIGH_LEVEL;
     gpio_config(&io_conf);
+    gpio_intr_disable(E_BUSY_PIN);
+    gpio_isr_handler_add(E_BUSY_PIN, busyISR, this);
+    esp_sleep_enable_gpio_wakeup();
 
     // Set initial state
-    gpio_set_level(E_CS_PIN, 1);
     gpio_set_level(E_DC_PIN, 1);
     gpio_set_level(E_RST_PIN, 1);
 
@@ -299,10 +1114,10 @@ esp_err_t BDEpaper::spiInit() {
         .clock_speed_hz = SPI_SPEED,
         .input_delay_ns = 0,
         .sample_point = SPI_SAMPLING_POINT_PHASE_0,
-        .spics_io_num = -1,
+        .spics_io_num = E_CS_PIN,
         .flags = 0,
-        .queue_size = 1,
-        .pre_cb = NULL,
+        .queue_size = SPI_QUEUE_SIZE,
+        .pre_cb = spiPreTransfer,
         .post_cb = NULL
     };
 
@@ -312,117 +1127,174 @@ esp_err_t BDEpaper::spiInit() {
         return ret;
     }
 
-    ESP_LOGI(TAG, "SPI initialized");
+    spi_pending = 0;
+    spi_next = 0;
+
+    ESP_LOGI(TAG, "SPI initialized at %d Hz", SPI_SPEED);
     return ESP_OK;
 }
 
-void BDEpaper::panelInit() {
+void BDPanel::panelInit() {
     powerOn();
 
     vTaskDelay(pdMS_TO_TICKS(100));
     spiR();
     vTaskDelay(pdMS_TO_TICKS(50));
-    wait();
+    wait(BUSY_RESET);
 
     uint16_t settingInt;
     memcpy(&settingInt, &panelSettings, 2);
 
-    spiC(E_CMD_PANEL_SETTINGS);
-    spiD(settingInt);
-    spiD(settingInt >> 8);
+    uint8_t init_script[] = {
+        E_CMD_PANEL_SETTINGS, 2, (uint8_t) settingInt, (uint8_t) (settingInt >> 8)
+    };
+    spiScript(init_script, sizeof(init_script));
 
     initialized = true;
     ESP_LOGI(TAG, "Panel initialized");
 }
 
-void BDEpaper::spiR() {
+void BDPanel::spiR() {
     gpio_set_level(E_RST_PIN, 0);
     vTaskDelay(pdMS_TO_TICKS(10));
     gpio_set_level(E_RST_PIN, 1);
     vTaskDelay(pdMS_TO_TICKS(10));
 }
 
-void BDEpaper::wait(uint32_t timeout_ms) {
-    uint32_t start = xTaskGetTickCount();
-    while (gpio_get_level(E_BUSY_PIN) == 0) {
-        if (timeout_ms > 0) {
-            uint32_t elapsed = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
-            if (elapsed >= timeout_ms) {
-                ESP_LOGW(TAG, "Wait busy timeout (%lu ms)", timeout_ms);
-                return;
-            }
-        }
-        vTaskDelay(pdMS_TO_TICKS(5));
+void IRAM_ATTR BDPanel::busyReady() {
+    // Level interrupt, so silence it until the next wait
+    gpio_intr_disable(E_BUSY_PIN);
+
+    BaseType_t hpw = pdFALSE;
+    if (busy_task) vTaskNotifyGiveIndexedFromISR(busy_task, BUSY_NOTIFY_INDEX, &hpw);
+    portYIELD_FROM_ISR(hpw);
+}
+
+void BDPanel::wait(BusyPhase phase, uint32_t timeout_ms) {
+    static const char *phases[] = {"reset", "refresh", "sleep"};
+    spiWait();
+    int64_t start = esp_timer_get_time();
+
+    busy_task = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTakeIndexed(BUSY_NOTIFY_INDEX, pdTRUE, 0);
+
+    // BUSY is low while the panel works, the rising level wakes us from light sleep
+    gpio_wakeup_enable(E_BUSY_PIN, GPIO_INTR_HIGH_LEVEL);
+    gpio_intr_enable(E_BUSY_PIN);
+
+    bool ready = gpio_get_level(E_BUSY_PIN) == 1 ||
+        ulTaskNotifyTakeIndexed(BUSY_NOTIFY_INDEX, pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0 ||
+        gpio_get_level(E_BUSY_PIN) == 1;
+
+    gpio_intr_disable(E_BUSY_PIN);
+    gpio_wakeup_disable(E_BUSY_PIN);
+    busy_task = NULL;
+
+    busy_ms[phase] = (esp_timer_get_time() - start) / 1000;
+    if (!ready) {
+        ESP_LOGW(TAG, "Wait busy timeout in %s (%lu ms)", phases[phase], timeout_ms);
+        return;
     }
+    ESP_LOGI(TAG, "Busy in %s for %lu ms", phases[phase], busy_ms[phase]);
 }
 
-void BDEpaper::spiC(PanelCommands cmd) {
-    gpio_set_level(E_CS_PIN, 0);
-    gpio_set_level(E_DC_PIN, 0);  // Command mode
+uint32_t BDPanel::busyTime(BusyPhase phase) {
+    return busy_ms[phase];
+}
 
-    spi_transaction_t t = {
-        .flags = 0,
-        .cmd = 0,
-        .addr = 0,
-        .length = 8,
-        .rxlength = 0,
-        .override_freq_hz = 0,
-        .user = NULL,
-        .tx_buffer = &cmd,
-        .rx_buffer = NULL
-    };
-    spi_device_polling_transmit(spiHandle, &t);
+void BDPanel::spiC(PanelCommands cmd) {
+    uint8_t c = cmd;
+    spiQueue(&c, 1, false);
+}
+
+void BDPanel::spiScript(const uint8_t *script, size_t len) {
+    // One transaction for each command byte and one for all of its data
+    size_t i = 0;
+    while (i + 1 < len) {
+        uint8_t count = script[i + 1];
+        spiQueue(&script[i], 1, false);
+        if (count > 0) {
+            spiQueue(&script[i + 2], count, true);
+        }
+        i += 2 + count;
+    }
 
-    gpio_set_level(E_CS_PIN, 1);
+    spiWait();
 }
 
-void BDEpaper::spiD(uint8_t data) {
-    gpio_set_level(E_CS_PIN, 0);
-    gpio_set_level(E_DC_PIN, 1);  // Data mode
+void BDPanel::spiQueue(const uint8_t *data, uint32_t len, bool dc) {
+    // Reuse the oldest slot once the driver queue is full
+    if (spi_pending == SPI_QUEUE_SIZE) {
+        spi_transaction_t *done;
+        spi_device_get_trans_result(spiHandle, &done, portMAX_DELAY);
+        spi_pending--;
+    }
 
-    spi_transaction_t t = {
+    spi_transaction_t *t = &spi_trans[spi_next];
+    *t = {
         .flags = 0,
         .cmd = 0,
         .addr = 0,
-        .length = 8,
+        .length = len * 8,
         .rxlength = 0,
         .override_freq_hz = 0,
-        .user = NULL,
-        .tx_buffer = &data,
+        .user = (void*) dc,  // D/C level, applied in spiPreTransfer
+        .tx_buffer = data,
         .rx_buffer = NULL
     };
-    spi_device_polling_transmit(spiHandle, &t);
-
-    gpio_set_level(E_CS_PIN, 1);
+    if (len <= 4) {
+        // Short writes are copied so the caller's buffer need not outlive the queue
+        t->flags = SPI_TRANS_USE_TXDATA;
+        memcpy(t->tx_data, data, len);
+    }
+    spi_device_queue_trans(spiHandle, t, portMAX_DELAY);
+    spi_pending++;
+    spi_next = (spi_next + 1) % SPI_QUEUE_SIZE;
 }
 
-void BDEpaper::spiBulk(const uint8_t *data, uint32_t len) {
-    gpio_set_level(E_CS_PIN, 0);
-    gpio_set_level(E_DC_PIN, 1);  // Data mode
+void BDPanel::spiWait() {
+    // Blocks until the DMA transfers have completed, the CPU is free meanwhile
+    while (spi_pending > 0) {
+        spi_transaction_t *done;
+        spi_device_get_trans_result(spiHandle, &done, portMAX_DELAY);
+        spi_pending--;
+    }
+}
 
+void BDPanel::spiQueueBulk(const uint8_t *data, uint32_t len) {
     // Send in chunks to avoid SPI transfer limit
     uint32_t offset = 0;
     while (offset < len) {
         uint32_t chunk_size = (len - offset > SPI_MAX_CHUNK_SIZE) ? SPI_MAX_CHUNK_SIZE : (len - offset);
-        spi_transaction_t t = {
-            .flags = 0,
-            .cmd = 0,
-            .addr = 0,
-            .length = chunk_size * 8,
-            .rxlength = 0,
-            .override_freq_hz = 0,
-            .user = NULL,
-            .tx_buffer = data + offset,
-            .rx_buffer = NULL
-        };
-        spi_device_polling_transmit(spiHandle, &t);
+        spiQueue(data + offset, chunk_size, true);
         offset += chunk_size;
     }
+}
+
+void BDPanel::spiBulk(const uint8_t *data, uint32_t len) {
+    int64_t start = esp_timer_get_time();
 
-    gpio_set_level(E_CS_PIN, 1);
+    spiQueueBulk(data, len);
+
+    spiWait();
+    spi_us += esp_timer_get_time() - start;
+}
+
+void BDPanel::spiWindow(const uint8_t *data, uint16_t cols, const PanelWindow &win) {
+    uint16_t len = win.colEnd - win.colStart + 1;
+
+    int64_t start = esp_timer_get_time();
+
+    // One transaction per gate line, only the window's byte columns
+    for (uint16_t line = win.lineStart; line <= win.lineEnd; line++) {
+        spiQueue(data + line * cols + win.colStart, len, true);
+    }
+
+    spiWait();
+    spi_us += esp_timer_get_time() - start;
 }
 
-void BDEpaper::powerOn() {
+void BDPanel::powerOn() {
     if (pwrState) return;
 
     // Turn peripherals on
@@ -430,19 +1302,50 @@ void BDEpaper::powerOn() {
     pwrState = true;
 }
 
-lv_display_t* BDEpaper::init() {
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+void BDEpaper<Width, Height, Bpp, Rotation, Kwr>::setDitherMode(DitherMode mode) {
+    dither_mode = mode;
+    ESP_LOGI(TAG, "Dither mode %s", dither_names[mode]);
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+uint32_t BDEpaper<Width, Height, Bpp, Rotation, Kwr>::skipCount() {
+    return skip_count;
+}
+
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+lv_display_t* BDEpaper<Width, Height, Bpp, Rotation, Kwr>::init() {
     spiInit();
 
+    prefs.begin(NVS_EPAPER_NAMESPACE, false);
+    frame_hash = prefs.getUInt(NVS_FRAME_HASH, 0);
+    skip_count = prefs.getUInt(NVS_SKIP_COUNT, 0);
+    ESP_LOGI(TAG, "Dither mode %s", dither_names[dither_mode]);
+
+#if DISPLAY_LITE == 1
+    // Frames come from the lite renderer, LVGL is never initialized
+    return NULL;
+#else
     // Create LVGL display
-    lv_display_t *disp = lv_display_create(DISPLAY_X, DISPLAY_Y);
+    lv_display_t *disp = lv_display_create(X, Y);
+    lvgl_disp = disp;
 
     lv_display_set_user_data(disp, this);
     // Run timer before registering callback
     lv_timer_handler();
-    lv_display_set_flush_cb(disp, lvgl_flush_cb);
+    lv_display_set_flush_cb(disp, lvgl_flush_cb<BDEpaper>);
+    lv_display_add_event_cb(disp, lvgl_render_start_cb<BDEpaper>, LV_EVENT_RENDER_START, this);
+    lv_display_add_event_cb(disp, lvgl_invalidate_cb<BDEpaper>, LV_EVENT_INVALIDATE_AREA, this);
+
+#if DISPLAY_RENDER_I1
+    lv_display_set_color_format(disp, LV_COLOR_FORMAT_I1);
+#endif
 
-    lv_display_render_mode_t render_mode = LV_DISPLAY_RENDER_MODE_PARTIAL;
-    lv_display_set_buffers(disp, lvgl_buf, NULL, lvgl_buf_size, render_mode);
+    // Buffers are set for each render by reserveArena
 
     return disp;
+#endif
 }
+
+template class BDEpaper<PANEL_LINES, PANEL_SOURCES, DISPLAY_B, DISPLAY_ROTATION, DISPLAY_KWR>;
+Epaper epaper;
@@ -2,12 +2,44 @@
 #include "driver/spi_master.h"
 
 #include "estructs.h"
+#include "prefs.h"
 
-#define DISPLAY_X 416
-#define DISPLAY_Y 240
+#define PANEL_LINES 416 // gate lines
+#define PANEL_SOURCES 240 // source outputs
+#define DISPLAY_ROTATION 0 // 0 and 180 are landscape, 90 and 270 portrait
 #define DISPLAY_B 1 // bits per pixel
+#ifndef DISPLAY_KWR
+#define DISPLAY_KWR 0 // black/white/red panel, saturated red pixels go to the red plane
+#endif
+#ifndef DISPLAY_DITHER
+// DitherMode RGB565 frames are converted with. Ordered by default, the
+// diffusing modes make LVGL redraw the whole screen on every change.
+#define DISPLAY_DITHER DITHER_BAYER
+#endif
+#ifndef DISPLAY_RENDER_I1
+#define DISPLAY_RENDER_I1 0 // LVGL renders 1-bpp directly, no dithering of grey
+#endif
+// 1 draws the fixed layout without LVGL objects, 2 also checks it against
+// LVGL. Off until a device run in mode 2 logs "Frames identical" and its
+// RAM, flash and render time savings are measured, see lite.h.
+#define DISPLAY_LITE 0
+#define FULL_REFRESH_INTERVAL 8 // partial refreshes before a full one clears ghosting
+#define PANEL_WINDOW_BYTES 9 // PARTIAL_WINDOW parameters
 #define SPI_MAX_CHUNK_SIZE 4096
+#define SPI_QUEUE_SIZE 4
 #define SPI_SPEED 4000000
+#define SPI_SPEED_MAX 10000000 // rated write clock of the panel controller
+#define RENDER_SLICE_US 5000 // longest stretch of frame conversion between yields
+#define RENDER_SLEEP_US 500000 // longest stretch without lower priority tasks, well inside the watchdog timeout
+
+#define BUSY_TIMEOUT_MS 30000
+#define BUSY_NOTIFY_INDEX 1
+
+#define NVS_EPAPER_NAMESPACE "epaper"
+#define NVS_FRAME_HASH "hash" // CRC32 of the frame on the panel
+#define NVS_SKIP_COUNT "skips" // refreshes skipped since the first boot
+
+static_assert(SPI_SPEED <= SPI_SPEED_MAX, "SPI_SPEED above panel rating");
 
 #define EPD_PIXEL_BLACK     0x0
 #define EPD_PIXEL_WHITE     0x1
@@ -17,45 +49,201 @@
 #define EPD_PIXEL_BLUE      0x5
 #define EPD_PIXEL_GREEN     0x6
 
-class BDEpaper {
-    public:
-        BDEpaper();
-        ~BDEpaper() {};
+typedef enum {
+    BUSY_RESET,
+    BUSY_REFRESH,
+    BUSY_SLEEP,
+    BUSY_PHASES
+} BusyPhase;
 
-        lv_display_t* init();
-        void power();
-        void flush(lv_display_t *disp, const lv_area_t *area, uint8_t *color_p);
-    private:
-        uint8_t* rgb_buf;
-        uint8_t* lvgl_buf;
-        uint8_t* framebuffer;
-        bool fb_dirty;
+typedef enum {
+    DITHER_THRESHOLD,   // luma cut at 50%, greys become solid
+    DITHER_BAYER,       // ordered 8x8 pattern, stateless
+    DITHER_DIFFUSION,   // Floyd-Steinberg on every row
+    DITHER_AUTO         // Floyd-Steinberg only on rows carrying grey or error
+} DitherMode;
 
-        uint32_t lvgl_buf_size;
-        uint32_t buffer_size;
-        bool partial_render_mode;
+typedef enum {
+    PLANE_BW,   // 1 = white
+    PLANE_RED   // 0 = red, on KWR panels only
+} FramePlane;
 
-        // LVGL handling
+// Panel controller: SPI transport, BUSY handling and command sequences
+class BDPanel {
+    public:
+        BDPanel();
+        ~BDPanel() {};
+
+        void busyReady();
+        uint32_t busyTime(BusyPhase phase);
+    protected:
         bool initialized;
-        void applyDithering();
-        void flushDisplay();
 
         // SPI
         spi_device_handle_t spiHandle;
+        spi_transaction_t spi_trans[SPI_QUEUE_SIZE];
+        uint8_t spi_pending;
+        uint8_t spi_next;
+        int64_t spi_us;
         esp_err_t spiInit();
         void spiR();
-        void wait(uint32_t timeout_ms = 0);
+        TaskHandle_t busy_task;
+        uint32_t busy_ms[BUSY_PHASES];
+        void wait(BusyPhase phase, uint32_t timeout_ms = BUSY_TIMEOUT_MS);
         void spiC(PanelCommands cmd);
-        void spiD(uint8_t data);
+        void spiScript(const uint8_t *script, size_t len);
+        void spiQueue(const uint8_t *data, uint32_t len, bool dc);
+        void spiWait();
+        void spiQueueBulk(const uint8_t *data, uint32_t len);
         void spiBulk(const uint8_t *data, uint32_t len);
+        void spiWindow(const uint8_t *data, uint16_t cols, const PanelWindow &win);
 
         // Epaper specific
         PanelSettings panelSettings;
         bool pwrState;
         void panelInit();
         void powerOn();
-        void panelWrite(const uint8_t *data, uint32_t len);
+        void panelWrite(const uint8_t *old, const uint8_t *data, uint32_t len);
+        void panelWriteWindow(const uint8_t *old, const uint8_t *data, uint16_t cols, const PanelWindow &win);
         void panelUpdate();
+        void panelSleep();
+};
+
+// Frame pipeline for a panel of Width gate lines by Height sources. All
+// geometry is known at compile time so the pixel loops fold to shifts.
+template <uint16_t Width, uint16_t Height, uint8_t Bpp, uint16_t Rotation, bool Kwr>
+class BDEpaper : public BDPanel {
+    static_assert(Bpp == 1 || Bpp == 2 || Bpp == 4, "unsupported bits per pixel");
+    static_assert(Height % 8 == 0, "sources must fill whole framebuffer bytes");
+    static_assert(Rotation % 90 == 0 && Rotation < 360, "rotation in steps of 90 degrees");
+    static_assert(!DISPLAY_RENDER_I1 || Bpp == 1, "I1 rendering needs a 1-bpp panel");
+    static_assert(!Kwr || (Bpp == 1 && !DISPLAY_RENDER_I1), "KWR panels take two 1-bpp planes from RGB565");
+    static_assert(!DISPLAY_LITE || !DISPLAY_RENDER_I1, "the lite renderer draws RGB565");
+    static_assert(DISPLAY_DITHER >= DITHER_THRESHOLD && DISPLAY_DITHER <= DITHER_AUTO, "unknown dither mode");
+
+    public:
+        static constexpr bool Portrait = Rotation % 180 != 0;
+        static constexpr uint16_t X = Portrait ? Height : Width; // LVGL resolution
+        static constexpr uint16_t Y = Portrait ? Width : Height;
+        static constexpr uint16_t Cols = Height * Bpp / 8; // framebuffer bytes per gate line
+        static constexpr uint32_t BufferSize = (uint32_t) Width * Cols;
+
+        BDEpaper();
+        ~BDEpaper() {};
+
+        lv_display_t* init();
+        void flush(lv_display_t *disp, const lv_area_t *area, uint8_t *color_p);
+        void flushArea(const lv_area_t *area, uint8_t *color_p, bool is_last);
+        void renderStart();
+        void invalidate(lv_area_t *area);
+        void renderAhead(bool enable);
+        bool showAhead();
+        bool dropAhead();
+        uint8_t* renderBuffer(uint32_t &size);
+        bool reserveArena();
+        void releaseArena();
+#if DISPLAY_LITE == 2
+        bool checkStart();
+        uint32_t checkEnd();
+#endif
+        void setDitherMode(DitherMode mode); // DISPLAY_DITHER until changed
+        uint32_t skipCount();
+    private:
+        static constexpr uint8_t PixelsPerByte = 8 / Bpp;
+        static constexpr uint8_t FillByte = Bpp == 1 ? 0xFF : (Bpp == 2 ? 0x55 : 0x11); // all white
+
+        uint8_t* dither_rows;
+        bool dither_grey[2];
+        uint16_t diffused_rows;
+        DitherMode dither_mode;
+        uint8_t row_tile[Kwr ? 2 : 1][8][X / 8];
+        uint8_t* lvgl_buf;
+        uint8_t* framebuffer;
+        uint8_t* redbuffer;
+        uint8_t* lastframe;
+        bool fb_dirty;
+        bool lastframe_valid;
+        uint8_t partial_count;
+        uint32_t frame_hash;
+        uint32_t skip_count;
+        Preferences prefs;
+
+        uint32_t lvgl_buf_size;
+        uint32_t buffer_size;
+        bool partial_render_mode;
+
+        // Areas LVGL marked for redraw since the last render, as one bounding box
+        lv_area_t invalidated;
+        bool full_frame;
+        PanelWindow dirty;
+
+        // A frame rendered ahead of its time stays in the framebuffer
+        // until showAhead sends it or dropAhead discards it
+        bool rendering_ahead;
+        bool ahead_valid;
+#if DISPLAY_LITE == 2
+        // Reference frame and ahead state held while a check render runs
+        uint8_t* check_frame;
+        bool check_ahead[2];
+#endif
+
+        // Bands sent while later ones render, for frames that get a full refresh
+        static constexpr uint16_t SlotSize = 16 + Width * (Kwr ? 2 : 1);
+        bool streaming;
+        uint16_t rows_done;
+        uint16_t rows_sent;
+        uint8_t stream_slot;
+        uint8_t* stream_slots;
+        void streamBands();
+        void streamWindow(const PanelWindow &win, uint8_t *script, const uint8_t *bw, const uint8_t *red, uint32_t len);
+
+        // The framebuffer and the scratch only a render needs, LVGL's draw
+        // buffer, the stream slots and the dither rows, are carved from one
+        // block that exists from reserveArena to releaseArena. A frame kept
+        // ahead holds on to the framebuffer part until it is shown or dropped.
+#if DISPLAY_RENDER_I1
+        static constexpr uint32_t LvglBufSize = 8 + (X + 7) / 8 * 80; // palette, then 80 packed rows
+        static constexpr uint32_t ReserveBufSize = 8 + (X + 7) / 8 * 8; // 8 rows
+#else
+        static constexpr uint32_t LvglBufSize = X * 10 * sizeof(uint16_t); // 10 rows of RGB565
+        static constexpr uint32_t ReserveBufSize = X * 2 * sizeof(uint16_t); // 2 rows
+#endif
+        static constexpr uint32_t DitherRowsSize = 2 * X * 3; // two rows of RGB888
+        static constexpr uint32_t ScratchSize = ((LvglBufSize + 3) & ~3) + ((2 * SlotSize + 3) & ~3) + DitherRowsSize;
+        static constexpr uint32_t ReserveSize = ((ReserveBufSize + 3) & ~3) + ((2 * SlotSize + 3) & ~3) + DitherRowsSize;
+        static constexpr uint32_t ArenaSize = BufferSize + ScratchSize;
+        // When fragmentation leaves no block that large, the last frame is
+        // patched in place and this reserve, with a smaller LVGL buffer,
+        // stands in for the scratch
+        alignas(4) uint8_t reserve[ReserveSize];
+        uint8_t* arena;
+        uint8_t* scratch;
+        int64_t arena_start;
+        lv_display_t* lvgl_disp;
+        void carveScratch(uint8_t *base, uint32_t lvgl_size);
+        void releaseFrame();
+
+        // LVGL handling
+        int64_t convert_us;
+        int64_t render_start;
+        uint32_t render_cpu;
+        int64_t slice_start;
+        int64_t sleep_start;
+        int64_t yield_us;
+        bool wdt_added;
+        void yieldIfDue();
+        void convertRgb565(const lv_area_t *area, const uint16_t *buffer);
+        void convertPalette(const lv_area_t *area, const uint16_t *buffer);
+        void convertI1(const lv_area_t *area, const uint8_t *bits);
+        void ditherRow(int y, uint8_t *row, uint8_t *next);
+        void quantizeRgb565(const lv_area_t *area, const uint16_t *buffer);
+        void setPixel(uint16_t x, uint16_t y, uint8_t color, FramePlane plane = PLANE_BW);
+        uint8_t* rowBits(int y, FramePlane plane = PLANE_BW);
+        void storeRow(int y, FramePlane plane = PLANE_BW);
+        void flushDisplay();
+        void commitFrame(uint32_t hash);
+        bool findWindow(PanelWindow &win);
 };
 
-extern BDEpaper epaper;
+typedef BDEpaper<PANEL_LINES, PANEL_SOURCES, DISPLAY_B, DISPLAY_ROTATION, DISPLAY_KWR> Epaper;
+extern Epaper epaper;
@@ -25,6 +25,11 @@ typedef enum {
     AUTO_SEQUENCE_PON_DRF_POF_DSLP = 0xA7
 } EpaperAuto;
 
+typedef enum {
+    PT_SCAN_WINDOW,
+    PT_SCAN_ALL
+} EpaperPartialScan;
+
 typedef enum {
     RESOLUTION_240x120,
     RESOLUTION_320x160,
@@ -104,6 +109,14 @@ struct PanelSettings {
     uint8_t reserved : 3;
 };
 
+// Byte columns along the source lines, gate lines inclusive
+struct PanelWindow {
+    uint16_t colStart;
+    uint16_t colEnd;
+    uint16_t lineStart;
+    uint16_t lineEnd;
+};
+
 typedef enum {
     VGH_20V_VGL_N20V,
     VGH_19V_VGL_N19V,
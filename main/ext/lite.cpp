@@ -0,0 +1,163 @@
+#include "lite.h"
+
+#include "epaper.h"
+
+#include <algorithm>
+
+#define LITE_MAX_ITEMS 32
+
+LiteRenderer lite;
+
+// LVGL's conversion of 24-bit colours to RGB565
+static constexpr uint16_t rgb565(uint32_t hex) {
+    return ((hex >> 8) & 0xF800) | ((hex >> 5) & 0x07E0) | ((hex >> 3) & 0x001F);
+}
+
+static constexpr uint16_t White = 0xFFFF;
+static constexpr uint16_t Black = 0x0000;
+// Labels are drawn in the text colour of LVGL's default light theme
+static constexpr uint16_t TextColor = rgb565(0x212121);
+static constexpr uint16_t AccentColor = rgb565(0xFF0000);
+
+// Glyph values to coverage, as LVGL expands them
+static const uint8_t opa1[] = { 0, 255 };
+static const uint8_t opa2[] = { 0, 85, 170, 255 };
+static const uint8_t opa4[] = { 0, 17, 34, 51, 68, 85, 102, 119, 136, 153, 170, 187, 204, 221, 238, 255 };
+
+// LVGL's lv_color_16_16_mix, so anti-aliased edges blend to the same values
+static inline uint16_t mix565(uint16_t fg, uint16_t bg, uint8_t mix) {
+    if (mix == 255) return fg;
+    if (mix == 0) return bg;
+    if (fg == bg) return fg;
+
+    mix = (uint32_t) (mix + 4) >> 3;
+    uint32_t b = (bg | ((uint32_t) bg << 16)) & 0x7E0F81F;
+    uint32_t f = (fg | ((uint32_t) fg << 16)) & 0x7E0F81F;
+    uint32_t result = ((((f - b) * mix) >> 5) + b) & 0x7E0F81F;
+    return (uint16_t) (result >> 16) | result;
+}
+
+int LiteRenderer::textWidth(const lv_font_t *font, const char *text) {
+    int width = 0;
+    for (const char *c = text; *c; c++) {
+        lv_font_glyph_dsc_t g;
+        if (lv_font_get_glyph_dsc(font, &g, (uint8_t) c[0], (uint8_t) c[1])) width += g.adv_w;
+    }
+    return width;
+}
+
+void LiteRenderer::drawImage(uint16_t *band, int y0, int y1, int x, int y, const lv_image_dsc_t *img) {
+    constexpr int X = Epaper::X;
+    if (img->header.cf != LV_COLOR_FORMAT_I1) return;
+
+    // Two ARGB8888 palette entries stored B, G, R, A, then MSB-first rows
+    const uint8_t *pal = img->data;
+    const uint16_t colors[2] = {
+        rgb565(pal[2] << 16 | pal[1] << 8 | pal[0]),
+        rgb565(pal[6] << 16 | pal[5] << 8 | pal[4])
+    };
+    const uint8_t *bits = img->data + 8;
+
+    int w = img->header.w;
+    int first = std::max(x, 0) - x, last = std::min(x + w, X) - x;
+    for (int row = std::max(y, y0); row <= std::min(y + (int) img->header.h - 1, y1); row++) {
+        const uint8_t *src = bits + (row - y) * img->header.stride;
+        uint16_t *dst = band + (row - y0) * X;
+        for (int i = first; i < last; i++) {
+            dst[x + i] = colors[(src[i >> 3] >> (7 - (i & 7))) & 1];
+        }
+    }
+}
+
+void LiteRenderer::drawText(uint16_t *band, int y0, int y1, int x, int y, int w, const lv_font_t *font, const char *text, uint16_t color) {
+    constexpr int X = Epaper::X;
+
+    // LVGL clips glyphs to the label, which is as tall as one line
+    int clip_x2 = std::min(x + w, X) - 1;
+    int clip_y1 = std::max(y, y0), clip_y2 = std::min(y + font->line_height - 1, y1);
+    if (clip_y1 > clip_y2) return;
+
+    int baseline = y + font->line_height - font->base_line;
+    int pos = x;
+    for (const char *c = text; *c; c++) {
+        lv_font_glyph_dsc_t g;
+        if (!lv_font_get_glyph_dsc(font, &g, (uint8_t) c[0], (uint8_t) c[1])) continue;
+        int gx = pos + g.ofs_x, gy = baseline - g.box_h - g.ofs_y;
+        pos += g.adv_w;
+
+        // Only plain bitmaps, as the built-in and subsetted fonts are stored
+        const lv_font_fmt_txt_dsc_t *fdsc = (const lv_font_fmt_txt_dsc_t *) g.resolved_font->dsc;
+        if (g.box_w == 0 || fdsc->bitmap_format != LV_FONT_FMT_TXT_PLAIN) continue;
+        const uint8_t *bitmap = fdsc->glyph_bitmap + fdsc->glyph_dsc[g.gid.index].bitmap_index;
+        uint8_t bpp = fdsc->bpp;
+        const uint8_t *opa = bpp == 1 ? opa1 : (bpp == 2 ? opa2 : opa4);
+        uint8_t mask = (1 << bpp) - 1;
+
+        // Pixels run on from row to row without padding
+        int col1 = std::max(gx, std::max(x, 0)), col2 = std::min(gx + g.box_w - 1, clip_x2);
+        for (int row = std::max(gy, clip_y1); row <= std::min(gy + g.box_h - 1, clip_y2); row++) {
+            uint16_t *dst = band + (row - y0) * X;
+            for (int col = col1; col <= col2; col++) {
+                uint32_t bit = ((row - gy) * g.box_w + (col - gx)) * bpp;
+                uint8_t v = (bitmap[bit >> 3] >> (8 - bpp - (bit & 7))) & mask;
+                dst[col] = mix565(color, dst[col], bpp == 8 ? v : opa[v]);
+            }
+        }
+    }
+}
+
+void LiteRenderer::draw(const LiteItem *items, uint8_t count, const LiteContent &content) {
+    constexpr int X = Epaper::X, Y = Epaper::Y;
+    count = std::min<uint8_t>(count, LITE_MAX_ITEMS);
+
+    uint32_t size;
+    uint16_t *band = (uint16_t *) epaper.renderBuffer(size);
+    int lines = size / (X * sizeof(uint16_t));
+
+    // Labels are as wide as their text, measured once for all bands
+    const char *text[LITE_MAX_ITEMS];
+    int16_t left[LITE_MAX_ITEMS], width[LITE_MAX_ITEMS];
+    for (uint8_t i = 0; i < count; i++) {
+        const LiteItem &item = items[i];
+        left[i] = item.x;
+        if (item.kind == LITE_IMAGE) {
+            left[i] += content.imgShift[item.slot];
+        } else if (item.kind == LITE_LABEL) {
+            text[i] = item.text ? item.text : content.text[item.slot];
+            width[i] = textWidth(*item.font, text[i]);
+            if (item.right) left[i] += X - width[i];
+        }
+    }
+
+    // Always the whole screen, in bands top to bottom like LVGL sends them
+    lv_area_t area = { 0, 0, X - 1, Y - 1 };
+    epaper.invalidate(&area);
+    epaper.renderStart();
+
+    for (int y0 = 0; y0 < Y; y0 += lines) {
+        int y1 = std::min(y0 + lines, Y) - 1;
+        std::fill(band, band + (y1 - y0 + 1) * X, White);
+
+        for (uint8_t i = 0; i < count; i++) {
+            const LiteItem &item = items[i];
+            switch (item.kind) {
+                case LITE_LINE:
+                    // LVGL leaves out the end point of horizontal lines
+                    if (item.y >= y0 && item.y <= y1) {
+                        std::fill(band + (item.y - y0) * X + item.x, band + (item.y - y0) * X + item.x2, Black);
+                    }
+                    break;
+                case LITE_IMAGE:
+                    if (content.img[item.slot]) drawImage(band, y0, y1, left[i], item.y, content.img[item.slot]);
+                    break;
+                case LITE_LABEL:
+                    drawText(band, y0, y1, left[i], item.y, width[i], *item.font, text[i],
+                        DISPLAY_KWR && item.accent ? AccentColor : TextColor);
+                    break;
+            }
+        }
+
+        area = { 0, y0, X - 1, y1 };
+        epaper.flushArea(&area, (uint8_t *) band, y1 == Y - 1);
+    }
+}
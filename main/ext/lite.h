@@ -0,0 +1,54 @@
+#pragma once
+
+#include "lvgl.h"
+
+typedef enum {
+    LITE_IMAGE, // LiteContent image `slot`, top left at x + its shift
+    LITE_LABEL, // one line of text in `font`, top left or top right aligned
+    LITE_LINE   // 1 px horizontal line from x to x2
+} LiteKind;
+
+// One element of a fixed layout, positioned the way the LVGL widgets it
+// stands in for are aligned on the screen
+typedef struct {
+    LiteKind kind;
+    bool right;      // x counts from the right edge, like LV_ALIGN_TOP_RIGHT
+    int16_t x;
+    int16_t y;
+    int16_t x2;
+    const lv_font_t *const *font; // looked up at draw time, assets can replace fonts
+    uint8_t slot;     // index into LiteContent, images and texts counted separately
+    const char *text; // fixed text, instead of a slot
+    bool accent;      // red on KWR panels
+} LiteItem;
+
+#define LITE_IMAGES 3
+#define LITE_TEXTS 7
+
+// What the layout shows in one frame
+typedef struct {
+    const lv_image_dsc_t *img[LITE_IMAGES];
+    int16_t imgShift[LITE_IMAGES];
+    const char *text[LITE_TEXTS];
+} LiteContent;
+
+// Draws a fixed layout band by band into the panel's render buffer and
+// hands the bands to the same conversion LVGL's flushes go through. Only
+// font data is taken from LVGL, no objects, draw buffers or heap.
+//
+// tools/bench checks its frames on the host against the layout drawn a
+// pixel at a time, in every dither mode.
+// Not yet measured on the device, which is what DISPLAY_LITE waits for:
+// render time from "Render wall/CPU" for both renders in mode 2, RAM from
+// "UI ready, N bytes of heap free" and idf.py size, flash from idf.py size
+// of mode 0 against mode 1.
+class LiteRenderer {
+    public:
+        void draw(const LiteItem *items, uint8_t count, const LiteContent &content);
+    private:
+        void drawImage(uint16_t *band, int y0, int y1, int x, int y, const lv_image_dsc_t *img);
+        void drawText(uint16_t *band, int y0, int y1, int x, int y, int w, const lv_font_t *font, const char *text, uint16_t color);
+        int textWidth(const lv_font_t *font, const char *text);
+};
+
+extern LiteRenderer lite;
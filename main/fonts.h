@@ -0,0 +1,7 @@
+#include "lvgl.h"
+
+// Generated at build time from LVGL's Montserrat by tools/font_tool.py,
+// with the glyphs main/fonts.json lists for the labels
+extern const lv_font_t montserrat14;
+extern const lv_font_t montserrat20;
+extern const lv_font_t montserrat48;
@@ -1,5 +1,9 @@
 #include "lvgl.h"
 
-extern const lv_image_dsc_t trash;
-extern const lv_image_dsc_t gardenWaste;
-extern const lv_image_dsc_t recycle;
+// Generated at build time from main/icons by tools/icon_tool.py
+extern const lv_image_dsc_t trashLarge;
+extern const lv_image_dsc_t trashSmall;
+extern const lv_image_dsc_t gardenWasteLarge;
+extern const lv_image_dsc_t gardenWasteSmall;
+extern const lv_image_dsc_t recycleLarge;
+extern const lv_image_dsc_t recycleSmall;
@@ -12,6 +12,7 @@
 
 #include "config.h"
 #include "ext/display.h"
+#include "ext/epaper.h"
 #include "sensor.h"
 #include "ext/adc.h"
 #include "zigbee/handlers.h"
@@ -166,13 +167,14 @@ void handleHeartbeat() {
         }
     }
 
-    if (heartbeatCounter % 360 == 0) {
-        // Every 6 hours
-        eink.render();
-    }
-
     heartbeatCounter++;
 
+    zbEndpoint.setDisplayStats(epaper.skipCount(), epaper.busyTime(BUSY_RESET),
+        epaper.busyTime(BUSY_REFRESH), epaper.busyTime(BUSY_SLEEP));
+
+    // The display is idle between scheduled refreshes, prepare the next one
+    eink.requestRenderAhead();
+
     if (zigbeeCore.connected) {
         zbEndpoint.report();
     } else {
@@ -193,7 +195,12 @@ static void main_task(void *pvParameters) {
 
 void binUpdate(bool boot, time_t black, time_t green, time_t brown) {
     eink.updateTimes(black, green, brown);
-    if (!boot) eink.render();
+    if (!boot) eink.requestRender();
+}
+
+void ruleUpdate(bool boot, uint8_t bin, const bin_rule_t &rule) {
+    eink.updateRule((Bins) bin, rule);
+    if (!boot) eink.requestRender();
 }
 
 static esp_err_t esp_zb_power_save_init(void)
@@ -235,6 +242,7 @@ extern "C" void app_main(void) {
 
     eink.init();
     zbEndpoint.onBinUpdate(binUpdate);
+    zbEndpoint.onRuleUpdate(ruleUpdate);
     zbEndpoint.init();
 
     zigbeeCore.registerEndpoint(&zbEndpoint);
@@ -247,6 +255,8 @@ extern "C" void app_main(void) {
     zbEndpoint.onConnect();
     zbEndpoint.requestOTA();
     zbEndpoint.fetchTime();
+    // Later refreshes are scheduled by the display itself
+    eink.requestRender();
 
     xTaskCreate(main_task, "Main", 4096, NULL, 4, NULL);
 }
@@ -0,0 +1,47 @@
+#include "schedule.h"
+
+#include <math.h>
+
+// Same local time of day, `days` calendar days later
+static time_t addDays(time_t t, int days) {
+    tm ti;
+    localtime_r(&t, &ti);
+    ti.tm_mday += days;
+    ti.tm_isdst = -1;
+    return mktime(&ti);
+}
+
+// Local midnight starting the day `days` after the one holding t
+time_t localMidnight(time_t t, int days) {
+    tm ti;
+    localtime_r(&t, &ti);
+    ti.tm_mday += days;
+    ti.tm_hour = 0;
+    ti.tm_min = 0;
+    ti.tm_sec = 0;
+    ti.tm_isdst = -1;
+    return mktime(&ti);
+}
+
+static bool isSkipped(const bin_rule_t &rule, time_t when) {
+    time_t day = localMidnight(when);
+    uint8_t count = rule.skip_count < SCHEDULE_MAX_SKIPS ? rule.skip_count : SCHEDULE_MAX_SKIPS;
+    for (uint8_t i = 0; i < count; i++) {
+        if (localMidnight((time_t) rule.skips[i] + SCHEDULE_EPOCH) == day) return true;
+    }
+    return false;
+}
+
+time_t nextCollection(const bin_rule_t &rule, time_t now) {
+    time_t anchor = (time_t) rule.anchor + SCHEDULE_EPOCH;
+
+    // A collection earlier today is still the next one until midnight
+    int behind = lround(difftime(localMidnight(now), localMidnight(anchor)) / 86400);
+    int n = behind > 0 ? (behind + rule.period - 1) / rule.period : 0;
+
+    time_t when = addDays(anchor, n * rule.period);
+    for (uint8_t i = 0; i < SCHEDULE_MAX_SKIPS && isSkipped(rule, when); i++) {
+        when = addDays(anchor, ++n * rule.period);
+    }
+    return when;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#define SCHEDULE_EPOCH 946684800 // rule times count from 1 January 2000, like ZCL UTCTime
+#define SCHEDULE_MAX_SKIPS 8
+
+// A bin collected every `period` days from `anchor`, except on the skip dates
+typedef struct __attribute__((packed)) {
+    uint32_t anchor;     // time of one collection
+    uint16_t period;     // days between collections, 0 when the bin has no rule, weeks arrive as 7 * n
+    uint8_t skip_count;
+    uint32_t skips[SCHEDULE_MAX_SKIPS]; // any time on a day without collection
+} bin_rule_t;
+
+time_t localMidnight(time_t t, int days = 0);
+time_t nextCollection(const bin_rule_t &rule, time_t now);
@@ -56,6 +56,12 @@ void ZigbeeSensor::createTimeCluster(esp_zb_cluster_list_t* cluster_list) {
 
 void ZigbeeSensor::createCustomClusters(esp_zb_cluster_list_t* cluster_list) {
     esp_zb_attribute_list_t *bin_cluster = esp_zb_zcl_attr_list_create(MS_BIN_CLUSTER_ID);
+
+    uint32_t zero = 0;
+    for (uint16_t attr = ATTR_FRAME_SKIPS; attr <= ATTR_BUSY_SLEEP; attr++) {
+        esp_zb_cluster_add_manufacturer_attr(bin_cluster, MS_BIN_CLUSTER_ID, attr, MANUFACTURER_CODE,
+            ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &zero);
+    }
     esp_zb_cluster_list_add_custom_cluster(cluster_list, bin_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE);
 }
 
@@ -128,11 +134,21 @@ esp_zb_cluster_list_t* ZigbeeSensor::createClusters() {
 }
 
 void ZigbeeSensor::zbCustomCommand(const esp_zb_zcl_custom_cluster_command_message_t *message) {
-    if (message->info.cluster != MS_BIN_CLUSTER_ID ||
-        message->info.command.id != CMD_SET_DISPLAY_TIMES) {
+    if (message->info.cluster != MS_BIN_CLUSTER_ID) {
         return;
     }
 
+    switch (message->info.command.id) {
+    case CMD_SET_DISPLAY_TIMES:
+        setDisplayTimes(message);
+        break;
+    case CMD_SET_SCHEDULE:
+        setSchedule(message);
+        break;
+    }
+}
+
+void ZigbeeSensor::setDisplayTimes(const esp_zb_zcl_custom_cluster_command_message_t *message) {
     if (message->data.size != sizeof(set_display_times_cmd_t)) {
         ESP_LOGW(TAG, "Invalid payload length: %d", message->data.size);
         return;
@@ -155,6 +171,30 @@ void ZigbeeSensor::zbCustomCommand(const esp_zb_zcl_custom_cluster_command_messa
     return;
 }
 
+void ZigbeeSensor::setSchedule(const esp_zb_zcl_custom_cluster_command_message_t *message) {
+    const size_t header = offsetof(set_schedule_cmd_t, rule.skips);
+
+    set_schedule_cmd_t payload = {};
+    if (message->data.size < header) {
+        ESP_LOGW(TAG, "Invalid payload length: %d", message->data.size);
+        return;
+    }
+    memcpy(&payload, message->data.value, header);
+
+    if (payload.bin > 2 || payload.rule.skip_count > SCHEDULE_MAX_SKIPS ||
+        message->data.size != header + payload.rule.skip_count * sizeof(uint32_t)) {
+        ESP_LOGW(TAG, "Invalid schedule: bin %d, %d skips, length %d", payload.bin, payload.rule.skip_count, message->data.size);
+        return;
+    }
+    memcpy(payload.rule.skips, (const uint8_t *) message->data.value + header, payload.rule.skip_count * sizeof(uint32_t));
+    ESP_LOGI(TAG, "New schedule for bin %d: from %lu every %d days, %d skipped", payload.bin, payload.rule.anchor, payload.rule.period, payload.rule.skip_count);
+
+    char key[8];
+    snprintf(key, sizeof(key), NVS_RULE_PREFIX "%d", payload.bin);
+    prefs.putBytes(key, &payload.rule, sizeof(payload.rule));
+    _on_rule_update(false, payload.bin, payload.rule);
+}
+
 void ZigbeeSensor::setBattery(uint8_t battery, uint8_t percentage) {
     esp_zb_zcl_set_attribute_val(
         _endpoint,
@@ -175,10 +215,29 @@ void ZigbeeSensor::setBattery(uint8_t battery, uint8_t percentage) {
     );
 }
 
+void ZigbeeSensor::setDisplayStats(uint32_t skips, uint32_t reset_ms, uint32_t refresh_ms, uint32_t sleep_ms) {
+    uint32_t values[] = { skips, reset_ms, refresh_ms, sleep_ms };
+    for (uint16_t attr = ATTR_FRAME_SKIPS; attr <= ATTR_BUSY_SLEEP; attr++) {
+        esp_zb_zcl_set_manufacturer_attribute_val(
+            _endpoint,
+            MS_BIN_CLUSTER_ID,
+            ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+            MANUFACTURER_CODE,
+            attr,
+            &values[attr - ATTR_FRAME_SKIPS],
+            false
+        );
+    }
+}
+
 void ZigbeeSensor::onBinUpdate(void (*callback)(bool, time_t, time_t, time_t)) {
     _on_bin_update = callback;
 }
 
+void ZigbeeSensor::onRuleUpdate(void (*callback)(bool, uint8_t, const bin_rule_t &)) {
+    _on_rule_update = callback;
+}
+
 void ZigbeeSensor::init() {
     prefs.begin(NVS_NAMESPACE, false);
     uint32_t blackBinTime = prefs.getUInt(NVS_BLACK, 0);
@@ -191,6 +250,15 @@ void ZigbeeSensor::init() {
         greenBinTime + OneJanuary2000,
         brownBinTime + OneJanuary2000
     );
+
+    for (uint8_t bin = 0; bin < 3; bin++) {
+        char key[8];
+        snprintf(key, sizeof(key), NVS_RULE_PREFIX "%d", bin);
+        bin_rule_t rule = {};
+        if (prefs.isKey(key) && prefs.getBytes(key, &rule, sizeof(rule)) == sizeof(rule)) {
+            _on_rule_update(true, bin, rule);
+        }
+    }
 }
 
 ZigbeeSensor::~ZigbeeSensor() {
@@ -223,7 +291,7 @@ ZigbeeSensor::ZigbeeSensor(uint8_t endpoint) : ZigbeeDevice(ESP_ZB_HA_SIMPLE_SEN
     _cluster_list = createClusters();
 }
 
-esp_err_t doReport(uint8_t _endpoint, esp_zb_zcl_cluster_id_t cluster, uint16_t attr) {
+esp_err_t doReport(uint8_t _endpoint, esp_zb_zcl_cluster_id_t cluster, uint16_t attr, uint16_t manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC) {
     // Must already have zb lock
     esp_zb_zcl_report_attr_cmd_t report_attr_cmd = {
         {
@@ -233,8 +301,8 @@ esp_err_t doReport(uint8_t _endpoint, esp_zb_zcl_cluster_id_t cluster, uint16_t
         },
         ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT,
         cluster,
-        {0, ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI, 0},
-        ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC,
+        {manuf_code != ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC, ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI, 0},
+        manuf_code,
         attr
     };
 
@@ -245,6 +313,9 @@ bool ZigbeeSensor::report() {
     esp_zb_lock_acquire(portMAX_DELAY);
     esp_err_t ret = doReport(_endpoint, ESP_ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ESP_ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_PERCENTAGE_REMAINING_ID) |
         doReport(_endpoint, ESP_ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ESP_ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_ID);
+    for (uint16_t attr = ATTR_FRAME_SKIPS; attr <= ATTR_BUSY_SLEEP; attr++) {
+        ret |= doReport(_endpoint, (esp_zb_zcl_cluster_id_t) MS_BIN_CLUSTER_ID, attr, MANUFACTURER_CODE);
+    }
     esp_zb_lock_release();
 
     return ret == ESP_OK;
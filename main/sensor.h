@@ -2,17 +2,26 @@
 
 #include "zigbee/endpoint.h"
 #include "prefs.h"
+#include "schedule.h"
 
 #define MANUFACTURER_CODE        0x1234
 
 #define MS_BIN_CLUSTER_ID        0xFC12
 #define CMD_SET_DISPLAY_TIMES    0x01
+#define CMD_SET_SCHEDULE         0x02
+
+// Read-only display diagnostics on the bin cluster, manufacturer specific
+#define ATTR_FRAME_SKIPS         0x0000 // refreshes skipped as the frame was unchanged
+#define ATTR_BUSY_RESET          0x0001 // ms the panel was busy in the last reset
+#define ATTR_BUSY_REFRESH        0x0002 // ms the panel was busy in the last refresh
+#define ATTR_BUSY_SLEEP          0x0003 // ms the panel was busy entering deep sleep
 
 #define OTA_UPGRADE_QUERY_INTERVAL (1 * 60)
 #define NVS_NAMESPACE         "config"
 #define NVS_BLACK             "black"
 #define NVS_GREEN             "green"
 #define NVS_BROWN             "brown"
+#define NVS_RULE_PREFIX       "rule" // followed by the bin index
 
 typedef struct {
     uint32_t black;
@@ -20,6 +29,12 @@ typedef struct {
     uint32_t brown;
 } set_display_times_cmd_t;
 
+// Only skip_count entries of skips are sent
+typedef struct __attribute__((packed)) {
+    uint8_t bin;
+    bin_rule_t rule;
+} set_schedule_cmd_t;
+
 class ZigbeeSensor : public ZigbeeDevice {
     public:
         ZigbeeSensor(uint8_t endpoint);
@@ -29,9 +44,11 @@ class ZigbeeSensor : public ZigbeeDevice {
 
         void init();
         void setBattery(uint8_t battery, uint8_t percentage);
+        void setDisplayStats(uint32_t skips, uint32_t reset_ms, uint32_t refresh_ms, uint32_t sleep_ms);
 
         void onConnect();
         void onBinUpdate(void (*callback)(bool, time_t, time_t, time_t));
+        void onRuleUpdate(void (*callback)(bool, uint8_t, const bin_rule_t &));
         void requestOTA();
         bool report();
 
@@ -58,6 +75,9 @@ class ZigbeeSensor : public ZigbeeDevice {
         void createOtaCluster(esp_zb_cluster_list_t* cluster_list);
         void createTimeCluster(esp_zb_cluster_list_t* cluster_list);
         void createCustomClusters(esp_zb_cluster_list_t* cluster_list);
+        void setDisplayTimes(const esp_zb_zcl_custom_cluster_command_message_t *message);
+        void setSchedule(const esp_zb_zcl_custom_cluster_command_message_t *message);
 
         void (*_on_bin_update)(bool, time_t, time_t, time_t);
+        void (*_on_rule_update)(bool, uint8_t, const bin_rule_t &);
 };
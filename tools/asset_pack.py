@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# Asset pack tool. Builds the read-only pack the firmware memory-maps from
+# the spiffs partition (see main/assets.h for the layout), so icons, font
+# subsets and layout constants can change without a firmware OTA. Write it with
+#
+#   parttool.py write_partition --partition-name spiffs --input assets.bin
+#
+# `idf.py flash` also writes the pack built alongside the app.
+#
+
+import argparse
+import json
+import os
+import struct
+import sys
+import zlib
+
+import font_tool
+import icon_tool
+
+MAGIC = 0x50415342  # "BSAP"
+VERSION = 1
+NAME_LEN = 24
+
+ASSET_IMAGE = 1
+ASSET_FONT = 2
+ASSET_CONST = 3
+TYPES = {ASSET_IMAGE: "image", ASSET_FONT: "font", ASSET_CONST: "const"}
+
+LV_COLOR_FORMAT_I1 = 0x07
+
+HEADER = struct.Struct("<IHHII")
+ENTRY = struct.Struct(f"<{NAME_LEN}sB3xII")
+IMAGE = struct.Struct("<HHHBx")
+FONT = struct.Struct("<hhbbBxHHBBBxI")
+
+
+def icon_assets(icon_dir):
+    """Every size of every icon in ICONS, packed like the built-in ones."""
+    assets = []
+    for name in sorted(icon_tool.ICONS):
+        width, height, rows = icon_tool.read_png(os.path.join(icon_dir, name + ".png"))
+        for variant, scale in icon_tool.ICONS[name].items():
+            w, h = icon_tool.scaled_size(width, scale), icon_tool.scaled_size(height, scale)
+            data = icon_tool.pack_i1(icon_tool.scale_box(width, height, rows, w, h))
+            payload = IMAGE.pack(w, h, (w + 7) // 8, LV_COLOR_FORMAT_I1) + data
+            assets.append((name + variant.capitalize(), ASSET_IMAGE, payload))
+    return assets
+
+
+def pack(assets):
+    table_end = HEADER.size + len(assets) * ENTRY.size
+    entries, body = [], bytearray()
+    for name, kind, payload in assets:
+        if len(name.encode()) >= NAME_LEN:
+            raise SystemExit(f"{name}: names are at most {NAME_LEN - 1} bytes")
+        body += b"\0" * (-len(body) % 4)
+        entries.append(ENTRY.pack(name.encode(), kind, table_end + len(body), len(payload)))
+        body += payload
+
+    rest = b"".join(entries) + body
+    return HEADER.pack(MAGIC, VERSION, len(assets), HEADER.size + len(rest), zlib.crc32(rest)) + rest
+
+
+def build(args):
+    with open(args.manifest) as f:
+        manifest = json.load(f)
+    root = os.path.dirname(os.path.abspath(args.manifest))
+
+    assets = icon_assets(os.path.join(root, manifest.get("icons", "icons")))
+    if args.fonts and "fonts" in manifest:
+        for name, _, sub in font_tool.subsets(os.path.join(root, manifest["fonts"]), args.fonts):
+            assets.append((name, ASSET_FONT, font_tool.pack_font(sub)))
+    for name, value in sorted(manifest.get("constants", {}).items()):
+        assets.append((name, ASSET_CONST, struct.pack("<i", value)))
+
+    data = pack(assets)
+    with open(args.output, "wb") as f:
+        f.write(data)
+    print(f"{args.output}: {len(assets)} assets, {len(data)} bytes")
+
+
+def show(args):
+    with open(args.pack, "rb") as f:
+        data = f.read()
+
+    magic, version, count, size, crc = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        raise SystemExit(f"{args.pack}: not a version {VERSION} asset pack")
+    ok = size == len(data) and zlib.crc32(data[HEADER.size:]) == crc
+    print(f"{count} assets, {size} bytes, CRC {'ok' if ok else 'BAD'}")
+
+    for i in range(count):
+        name, kind, offset, length = ENTRY.unpack_from(data, HEADER.size + i * ENTRY.size)
+        name = name.rstrip(b"\0").decode()
+        detail = ""
+        if kind == ASSET_IMAGE:
+            w, h, stride, cf = IMAGE.unpack_from(data, offset)
+            detail = f"{w}x{h} cf {cf:#04x}"
+        elif kind == ASSET_FONT:
+            line_height, _, _, _, bpp, glyphs, _, _, _, kerned, first = FONT.unpack_from(data, offset)
+            detail = f"{glyphs} glyphs from U+{first:04X}, {bpp} bpp, {line_height} px{', kerned' if kerned else ''}"
+        elif kind == ASSET_CONST:
+            detail = str(struct.unpack_from("<i", data, offset)[0])
+        print(f"  {name:<{NAME_LEN}} {TYPES.get(kind, kind):<6} {offset:6} {length:6}  {detail}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build and inspect display asset packs")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("build", help="write a pack from a JSON manifest")
+    p.add_argument("manifest")
+    p.add_argument("output")
+    p.add_argument("--fonts", metavar="FONT_DIR", help="LVGL's src/font directory, to pack the font subsets too")
+    p.set_defaults(func=build)
+
+    p = sub.add_parser("show", help="list the contents of a pack")
+    p.add_argument("pack")
+    p.set_defaults(func=show)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,592 @@
+// Host benchmark and check for the frame conversion in epaper.cpp. The
+// panel driver is built as is against the stand-ins in host/, frames go
+// through the same calls LVGL's flush makes and what reaches the panel is
+// read back from the emulated panel RAM.
+//
+//   g++ -std=gnu++20 -O2 -I tools/bench/host -I main/ext -I main
+//       tools/bench/convert_bench.cpp tools/bench/host/host.cpp
+//       main/ext/lite.cpp -o convert_bench
+//
+// Add -DDISPLAY_RENDER_I1=1 for the path where LVGL renders 1-bpp itself.
+// RGB565 builds also time and check the black/white/red variant against
+// the black/white one, -DDISPLAY_KWR=1 makes the KWR one the configured
+// panel. They also check the lite renderer, which DISPLAY_LITE switches
+// on, against a reference frame.
+// Log formats are written for the device's 32-bit long, -Wno-format
+// quiets them on a 64-bit host.
+// Timings are per frame on the host, the device logs its own in
+// "Frame converted in".
+
+#include "epaper.cpp"
+
+#include "host.h"
+#include "lite.h"
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+static constexpr int X = Epaper::X, Y = Epaper::Y;
+static constexpr int Band = 10; // rows per flush, as LVGL's draw buffer holds
+static constexpr int Runs = 40; // frames per timing, the best of Rounds counts
+static constexpr int Rounds = 5;
+
+typedef std::vector<uint16_t> Image;
+
+template <class D> struct PanelKwr;
+template <uint16_t W, uint16_t H, uint8_t B, uint16_t R, bool K>
+struct PanelKwr<BDEpaper<W, H, B, R, K>> { static constexpr bool value = K; };
+
+// The black/white plane of the last frame sent, KWR panels take it as DTM1
+template <class D>
+static const uint8_t *bwPlane() {
+    return hostPanelPlane(PanelKwr<D>::value);
+}
+
+// Black text on white with anti-aliased edges, what the display mostly shows
+static Image textImage(std::mt19937 &rng) {
+    Image img(X * Y, 0xFFFF);
+    for (int glyph = 0; glyph < 300; glyph++) {
+        int x0 = rng() % (X - 12), y0 = rng() % (Y - 16);
+        for (int y = y0; y < y0 + 16; y++) {
+            for (int x = x0; x < x0 + 12; x++) {
+                if (rng() % 3) continue;
+                img[y * X + x] = 0;
+                if (x + 1 < X && img[y * X + x + 1] == 0xFFFF) img[y * X + x + 1] = 0x8410;
+            }
+        }
+    }
+    return img;
+}
+
+static Image rampImage(std::mt19937 &) {
+    Image img(X * Y);
+    for (int y = 0; y < Y; y++) {
+        for (int x = 0; x < X; x++) {
+            int v = x * 32 / X;
+            img[y * X + x] = (v << 11) | (v * 2 << 5) | v;
+        }
+    }
+    return img;
+}
+
+static Image noiseImage(std::mt19937 &rng) {
+    Image img(X * Y);
+    for (auto &c : img) c = rng();
+    return img;
+}
+
+// The LVGL draw buffer for an area, RGB565 or thresholded to I1 behind a palette
+static std::vector<uint8_t> drawBuffer(const Image &img, const lv_area_t &a) {
+    std::vector<uint8_t> buf;
+#if DISPLAY_RENDER_I1
+    uint32_t stride = (a.x2 - a.x1 + 8) / 8;
+    buf.assign(8 + stride * (a.y2 - a.y1 + 1), 0);
+    for (int y = a.y1; y <= a.y2; y++) {
+        uint8_t *row = &buf[8 + (y - a.y1) * stride];
+        for (int x = a.x1; x <= a.x2; x++) {
+            if (luma565(img[y * X + x]) >= 128) row[(x - a.x1) >> 3] |= 0x80 >> ((x - a.x1) & 7);
+        }
+    }
+#else
+    for (int y = a.y1; y <= a.y2; y++) {
+        const uint8_t *row = (const uint8_t*) &img[y * X + a.x1];
+        buf.insert(buf.end(), row, row + (a.x2 - a.x1 + 1) * 2);
+    }
+#endif
+    return buf;
+}
+
+// Renders an area the way LVGL would, in bands, after the area has been
+// invalidated. The area may come back widened.
+template <class D = Epaper>
+static void render(const Image &img, lv_area_t area, bool show, D &d = epaper) {
+    d.invalidate(&area);
+    d.reserveArena();
+    d.renderStart();
+    for (int y = area.y1; y <= area.y2; y += Band) {
+        lv_area_t band = { area.x1, y, area.x2, std::min<int32_t>(y + Band - 1, area.y2) };
+        std::vector<uint8_t> buf = drawBuffer(img, band);
+        d.flushArea(&band, buf.data(), show && band.y2 == area.y2);
+    }
+    d.releaseArena();
+}
+
+// Conversion alone: bands are prepared up front and the frame is kept
+// like one rendered ahead, so nothing is hashed or sent
+template <class D = Epaper>
+static double timeFrame(const Image &img, D &d = epaper) {
+    lv_area_t full = { 0, 0, X - 1, Y - 1 };
+    std::vector<std::pair<lv_area_t, std::vector<uint8_t>>> bands;
+    for (int y = 0; y < Y; y += Band) {
+        lv_area_t band = { 0, y, X - 1, std::min(y + Band, Y) - 1 };
+        bands.push_back({ band, drawBuffer(img, band) });
+    }
+
+    double best = 1e12;
+    d.renderAhead(true);
+    for (int round = 0; round < Rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int run = 0; run < Runs; run++) {
+            lv_area_t area = full;
+            d.invalidate(&area);
+            d.reserveArena();
+            d.renderStart();
+            for (auto &band : bands) d.flushArea(&band.first, band.second.data(), band.first.y2 == Y - 1);
+            d.releaseArena();
+        }
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::micro>(end - start).count() / Runs);
+    }
+    d.renderAhead(false);
+    d.dropAhead();
+    return best;
+}
+
+// What a full frame puts in the black/white panel RAM. A blank frame goes first, so the
+// frame is not skipped as unchanged.
+template <class D = Epaper>
+static std::vector<uint8_t> panelFrame(const Image &img, D &d = epaper) {
+    lv_area_t full = { 0, 0, X - 1, Y - 1 };
+    render(Image(X * Y, 0xFFFF), full, true, d);
+    render(img, full, true, d);
+    return std::vector<uint8_t>(bwPlane<D>(), bwPlane<D>() + Epaper::BufferSize);
+}
+
+static uint32_t pixelDiff(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b) {
+    uint32_t diff = 0;
+    for (size_t i = 0; i < a.size(); i++) diff += __builtin_popcount(a[i] ^ b[i]);
+    return diff;
+}
+
+// The luma formula the conversion has always used, on RGB565 expanded to 8 bits
+static int oldLuma(uint16_t c) {
+    int r5 = c >> 11, g6 = (c >> 5) & 0x3F, b5 = c & 0x1F;
+    int r = (r5 << 3) | (r5 >> 2), g = (g6 << 2) | (g6 >> 4), b = (b5 << 3) | (b5 >> 2);
+    return (r * 299 + g * 587 + b * 114) / 1000;
+}
+
+#if !DISPLAY_RENDER_I1
+// Text with saturated red labels, for black/white/red panels
+static Image redTextImage(std::mt19937 &rng) {
+    Image img = textImage(rng);
+    for (int label = 0; label < 40; label++) {
+        int x0 = rng() % (X - 40), y0 = rng() % (Y - 12);
+        for (int y = y0; y < y0 + 12; y++) {
+            for (int x = x0; x < x0 + 40; x++) {
+                if (rng() % 2) img[y * X + x] = 0xF800;
+            }
+        }
+    }
+    return img;
+}
+
+// The other colour variant of the configured panel, so black/white and
+// black/white/red run side by side
+typedef BDEpaper<PANEL_LINES, PANEL_SOURCES, DISPLAY_B, DISPLAY_ROTATION, !DISPLAY_KWR> OtherEpaper;
+static OtherEpaper other;
+
+// KWR against black/white on the same frame. The black/white plane must
+// be what the black/white panel shows with red turned white, the red
+// plane what it shows thresholding red to black and everything else white.
+template <class Bw, class Kwr>
+static void kwrCheck(Bw &bw, Kwr &kwr, std::mt19937 &rng) {
+    static const char *modes[] = { "threshold", "bayer", "diffusion", "auto" };
+    Image img = redTextImage(rng);
+    Image whitened = img, mask(X * Y, 0xFFFF);
+    for (int i = 0; i < X * Y; i++) {
+        if (!red565(img[i])) continue;
+        whitened[i] = 0xFFFF;
+        mask[i] = 0;
+    }
+
+    bw.setDitherMode(DITHER_THRESHOLD);
+    std::vector<uint8_t> red_ref = panelFrame(mask, bw);
+
+    printf("Black/white/red against black/white, text with red labels\n");
+    for (int mode = DITHER_THRESHOLD; mode <= DITHER_AUTO; mode++) {
+        bw.setDitherMode((DitherMode) mode);
+        kwr.setDitherMode((DitherMode) mode);
+        std::vector<uint8_t> bw_ref = panelFrame(whitened, bw);
+        std::vector<uint8_t> bw_plane = panelFrame(img, kwr);
+        std::vector<uint8_t> red_plane(hostPanelPlane(), hostPanelPlane() + Epaper::BufferSize);
+
+        double bw_us = timeFrame(img, bw), kwr_us = timeFrame(img, kwr);
+        printf("%-9s bw %8.1f us, kwr %8.1f us (%+.0f%%), planes differ in %lu and %lu pixels\n",
+            modes[mode], bw_us, kwr_us, (kwr_us / bw_us - 1) * 100,
+            (unsigned long) pixelDiff(bw_ref, bw_plane), (unsigned long) pixelDiff(red_ref, red_plane));
+    }
+}
+
+// The conversion before the luma tables, as the baseline tree had it:
+// RGB888 expanded into a whole-frame buffer, then Floyd-Steinberg on all
+// three channels, one framebuffer bit at a time. Landscape layout only.
+static void baselineConvert(const Image &img, uint8_t *fb, bool diffuse) {
+    static uint8_t rgb[X * Y * 3];
+    for (int i = 0; i < X * Y; i++) {
+        uint16_t c = img[i];
+        int r5 = c >> 11, g6 = (c >> 5) & 0x3F, b5 = c & 0x1F;
+        rgb[i * 3] = (r5 << 3) | (r5 >> 2);
+        rgb[i * 3 + 1] = (g6 << 2) | (g6 >> 4);
+        rgb[i * 3 + 2] = (b5 << 3) | (b5 >> 2);
+    }
+    memset(fb, 0xFF, Epaper::BufferSize);
+
+    auto spread = [](uint8_t *p, const int *err, int num) {
+        for (int k = 0; k < 3; k++) p[k] = clamp_byte(p[k] + err[k] * num / 16);
+    };
+    for (int y = 0; y < Y; y++) {
+        for (int x = 0; x < X; x++) {
+            uint8_t *p = &rgb[(y * X + x) * 3];
+            int white = (p[0] * 299 + p[1] * 587 + p[2] * 114) / 1000 >= 128;
+            uint32_t byte = x * (Y / 8) + y / 8;
+            if (white) fb[byte] |= 0x80 >> (y & 7); else fb[byte] &= ~(0x80 >> (y & 7));
+            if (!diffuse) continue;
+
+            int err[3] = { p[0] - white * 255, p[1] - white * 255, p[2] - white * 255 };
+            if (x + 1 < X) spread(p + 3, err, 7);
+            if (y + 1 < Y && x > 0) spread(p + (X - 1) * 3, err, 3);
+            if (y + 1 < Y) spread(p + X * 3, err, 5);
+            if (y + 1 < Y && x + 1 < X) spread(p + (X + 1) * 3, err, 1);
+        }
+    }
+}
+
+static double timeBaseline(const Image &img) {
+    std::vector<uint8_t> fb(Epaper::BufferSize);
+    double best = 1e12;
+    for (int round = 0; round < Rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int run = 0; run < Runs; run++) baselineConvert(img, fb.data(), true);
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::micro>(end - start).count() / Runs);
+    }
+    return best;
+}
+#endif
+
+// A dirty area patched into the frame on the panel must come out the same
+// as the whole frame rendered again
+static uint32_t patchDiff(Image img, std::mt19937 &rng) {
+    lv_area_t full = { 0, 0, X - 1, Y - 1 };
+    uint32_t diff = 0;
+    for (int i = 0; i < 20; i++) {
+        render(img, full, true);
+        lv_area_t area;
+        area.x1 = rng() % (X - 1);
+        area.y1 = rng() % (Y - 1);
+        area.x2 = area.x1 + rng() % std::min(X - area.x1, 60);
+        area.y2 = area.y1 + rng() % std::min(Y - area.y1, 30);
+        for (int y = area.y1; y <= area.y2; y++) {
+            for (int x = area.x1; x <= area.x2; x++) img[y * X + x] = rng();
+        }
+        render(img, area, true);
+        std::vector<uint8_t> patched(bwPlane<Epaper>(), bwPlane<Epaper>() + Epaper::BufferSize);
+
+        diff += pixelDiff(patched, panelFrame(img));
+    }
+    return diff;
+}
+
+#if !DISPLAY_RENDER_I1
+// Glyphs shaped so labels clip them: B reaches back over the glyph before
+// it, C is taller than a line, D is wider than its advance
+static const struct {
+    char letter;
+    uint8_t adv_w, box_w, box_h;
+    int8_t ofs_x, ofs_y;
+} benchGlyphs[] = {
+    { ' ', 3, 0, 0, 0, 0 },
+    { 'A', 7, 6, 9, 0, 0 },
+    { 'B', 6, 5, 8, -2, 3 },
+    { 'C', 5, 8, 14, 1, -4 },
+    { 'D', 4, 7, 6, 0, -3 },
+};
+static constexpr int BenchGlyphs = sizeof(benchGlyphs) / sizeof(benchGlyphs[0]);
+
+// One font per glyph depth LVGL's plain bitmaps come in, random coverage
+struct BenchFont {
+    lv_font_fmt_txt_glyph_dsc_t glyphs[BenchGlyphs];
+    std::vector<uint8_t> bitmap;
+    lv_font_fmt_txt_dsc_t dsc;
+    lv_font_t font;
+};
+static BenchFont benchFonts[4];
+static const lv_font_t *benchFont[4];
+
+static bool benchGlyph(const lv_font_t *font, lv_font_glyph_dsc_t *g, uint32_t letter, uint32_t next) {
+    const lv_font_fmt_txt_dsc_t *dsc = (const lv_font_fmt_txt_dsc_t *) font->dsc;
+    for (int i = 0; i < BenchGlyphs; i++) {
+        if (benchGlyphs[i].letter != (char) letter) continue;
+        const lv_font_fmt_txt_glyph_dsc_t &gd = dsc->glyph_dsc[i];
+        // One kerning pair, A then B sits a pixel closer
+        g->adv_w = gd.adv_w - (letter == 'A' && next == 'B');
+        g->box_w = gd.box_w;
+        g->box_h = gd.box_h;
+        g->ofs_x = gd.ofs_x;
+        g->ofs_y = gd.ofs_y;
+        g->gid.index = i;
+        return true;
+    }
+    return false;
+}
+
+static void makeFonts(std::mt19937 &rng) {
+    static const uint8_t depths[] = { 1, 2, 4, 8 };
+    for (int f = 0; f < 4; f++) {
+        BenchFont &bf = benchFonts[f];
+        uint32_t index = 0;
+        for (int i = 0; i < BenchGlyphs; i++) {
+            bf.glyphs[i] = { index, benchGlyphs[i].adv_w, benchGlyphs[i].box_w, benchGlyphs[i].box_h,
+                benchGlyphs[i].ofs_x, benchGlyphs[i].ofs_y };
+            index += (benchGlyphs[i].box_w * benchGlyphs[i].box_h * depths[f] + 7) / 8;
+        }
+        bf.bitmap.resize(index);
+        for (auto &b : bf.bitmap) b = rng();
+        bf.dsc = {};
+        bf.dsc.glyph_bitmap = bf.bitmap.data();
+        bf.dsc.glyph_dsc = bf.glyphs;
+        bf.dsc.bpp = depths[f];
+        bf.dsc.bitmap_format = LV_FONT_FMT_TXT_PLAIN;
+        bf.font = {};
+        bf.font.get_glyph_dsc = benchGlyph;
+        bf.font.line_height = 12;
+        bf.font.base_line = 3;
+        bf.font.dsc = &bf.dsc;
+        benchFont[f] = &bf.font;
+    }
+}
+
+// I1 images behind a two colour ARGB8888 palette, stored B, G, R, A
+struct BenchImage {
+    lv_image_dsc_t dsc;
+    std::vector<uint8_t> data;
+};
+
+static void makeImage(BenchImage &img, int w, int h, uint8_t dark, std::mt19937 &rng) {
+    uint32_t stride = (w + 7) / 8;
+    img.data = { dark, dark, dark, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    for (uint32_t i = 0; i < stride * h; i++) img.data.push_back(rng());
+    img.dsc = {};
+    img.dsc.header.cf = LV_COLOR_FORMAT_I1;
+    img.dsc.header.w = w;
+    img.dsc.header.h = h;
+    img.dsc.header.stride = stride;
+    img.dsc.data_size = img.data.size();
+    img.dsc.data = img.data.data();
+}
+
+// lv_color_16_16_mix from LVGL 9, labels blend their glyphs with it
+static uint16_t lvglMix(uint16_t fg, uint16_t bg, uint8_t mix) {
+    if (mix == 255) return fg;
+    if (mix == 0 || fg == bg) return bg;
+    mix = (uint32_t) (mix + 4) >> 3;
+    uint32_t b = (bg | ((uint32_t) bg << 16)) & 0x7E0F81F;
+    uint32_t f = (fg | ((uint32_t) fg << 16)) & 0x7E0F81F;
+    uint32_t result = ((((f - b) * mix) >> 5) + b) & 0x7E0F81F;
+    return (uint16_t) (result >> 16) | result;
+}
+
+// What the LVGL widgets a layout stands in for draw, one whole frame at a
+// time and a pixel at a time: images unscaled, labels as wide as their
+// text with glyphs clipped to the label, lines without their end point
+static Image liteReference(const LiteItem *items, int count, const LiteContent &content) {
+    Image img(X * Y, 0xFFFF);
+    auto onScreen = [](int x, int y) { return x >= 0 && x < X && y >= 0 && y < Y; };
+    for (int i = 0; i < count; i++) {
+        const LiteItem &item = items[i];
+        if (item.kind == LITE_LINE) {
+            for (int x = item.x; x < item.x2; x++) img[item.y * X + x] = 0;
+        } else if (item.kind == LITE_IMAGE) {
+            const lv_image_dsc_t *dsc = content.img[item.slot];
+            if (!dsc) continue;
+            int left = item.x + content.imgShift[item.slot];
+            for (int r = 0; r < (int) dsc->header.h; r++) {
+                for (int q = 0; q < (int) dsc->header.w; q++) {
+                    if (!onScreen(left + q, item.y + r)) continue;
+                    int bit = (dsc->data[8 + r * dsc->header.stride + q / 8] >> (7 - q % 8)) & 1;
+                    const uint8_t *pal = dsc->data + bit * 4;
+                    img[(item.y + r) * X + left + q] = ((pal[2] >> 3) << 11) | ((pal[1] >> 2) << 5) | (pal[0] >> 3);
+                }
+            }
+        } else {
+            const lv_font_t *font = *item.font;
+            const lv_font_fmt_txt_dsc_t *fdsc = (const lv_font_fmt_txt_dsc_t *) font->dsc;
+            const char *text = item.text ? item.text : content.text[item.slot];
+            // 0x212121 is the default theme's text colour
+            uint16_t color = DISPLAY_KWR && item.accent ? 0xF800 : 0x2104;
+            int width = 0;
+            lv_font_glyph_dsc_t g;
+            for (const char *c = text; *c; c++) {
+                if (lv_font_get_glyph_dsc(font, &g, c[0], c[1])) width += g.adv_w;
+            }
+            int left = item.right ? X + item.x - width : item.x;
+
+            int pen = left;
+            for (const char *c = text; *c; c++) {
+                if (!lv_font_get_glyph_dsc(font, &g, c[0], c[1])) continue;
+                int gx = pen + g.ofs_x, gy = item.y + font->line_height - font->base_line - g.box_h - g.ofs_y;
+                pen += g.adv_w;
+                uint32_t start = fdsc->glyph_dsc[g.gid.index].bitmap_index * 8;
+                for (int r = 0; r < g.box_h; r++) {
+                    for (int q = 0; q < g.box_w; q++) {
+                        int x = gx + q, y = gy + r;
+                        if (x < left || x >= left + width || y < item.y || y >= item.y + font->line_height) continue;
+                        if (!onScreen(x, y)) continue;
+                        uint32_t bit = start + (r * g.box_w + q) * fdsc->bpp;
+                        uint32_t v = (fdsc->glyph_bitmap[bit / 8] >> (8 - fdsc->bpp - bit % 8)) & ((1 << fdsc->bpp) - 1);
+                        img[y * X + x] = lvglMix(color, img[y * X + x], v * 255 / ((1 << fdsc->bpp) - 1));
+                    }
+                }
+            }
+        }
+    }
+    return img;
+}
+
+// Both planes of the last frame sent
+static std::vector<uint8_t> panelPlanes() {
+    std::vector<uint8_t> planes(hostPanelPlane(true), hostPanelPlane(true) + Epaper::BufferSize);
+    planes.insert(planes.end(), hostPanelPlane(), hostPanelPlane() + Epaper::BufferSize);
+    return planes;
+}
+
+// The lite renderer against the reference frame going through LVGL's
+// flushes, in every dither mode. Labels and images are placed to be
+// clipped by the screen edges, their own bounds and band boundaries.
+static void liteCheck(std::mt19937 &rng) {
+    static const char *modes[] = { "threshold", "bayer", "diffusion", "auto" };
+    makeFonts(rng);
+    static BenchImage images[LITE_IMAGES];
+    makeImage(images[0], 13, 10, 0x00, rng);
+    makeImage(images[1], 40, 30, 0x80, rng);
+    makeImage(images[2], 48, 20, 0x00, rng);
+
+    static const LiteItem items[] = {
+        { LITE_IMAGE, false, 30, 3, 0, NULL, 0, NULL, false },
+        { LITE_LABEL, false, 0, 6, 0, &benchFont[2], 0, NULL, true },
+        { LITE_LABEL, true, 0, 27, 0, &benchFont[0], 1, NULL, false },
+        { LITE_LABEL, false, 120, 44, 0, &benchFont[1], 2, NULL, false },
+        { LITE_LABEL, true, -30, 44, 0, &benchFont[3], 3, NULL, true },
+        { LITE_LINE, false, 8, 80, X - 8, NULL, 0, NULL, false },
+        { LITE_IMAGE, false, 30, 100, 0, NULL, 1, NULL, false },
+        { LITE_LABEL, false, 100, 99, 0, &benchFont[2], 0, "AB CD", false },
+        { LITE_LABEL, false, 104, 104, 0, &benchFont[3], 4, NULL, false },
+        { LITE_IMAGE, false, 380, 232, 0, NULL, 2, NULL, false },
+        { LITE_LABEL, false, 300, 233, 0, &benchFont[0], 5, NULL, false },
+    };
+    static constexpr int Items = sizeof(items) / sizeof(items[0]);
+    LiteContent content = {};
+    for (int i = 0; i < LITE_IMAGES; i++) content.img[i] = &images[i].dsc;
+    content.imgShift[0] = -35;
+    static const char *texts[] = { "BACDA", "ABD", "CABBAC", "DCBA", "BCCC", "DADA" };
+    for (int i = 0; i < 6; i++) content.text[i] = texts[i];
+
+    Image ref = liteReference(items, Items, content);
+    lv_area_t full = { 0, 0, X - 1, Y - 1 };
+    printf("Lite renderer against the same layout drawn a pixel at a time\n");
+    for (int mode = DITHER_THRESHOLD; mode <= DITHER_AUTO; mode++) {
+        epaper.setDitherMode((DitherMode) mode);
+        render(Image(X * Y, 0xFFFF), full, true);
+        epaper.reserveArena();
+        lite.draw(items, Items, content);
+        epaper.releaseArena();
+        std::vector<uint8_t> drawn = panelPlanes();
+        render(Image(X * Y, 0xFFFF), full, true);
+        render(ref, full, true);
+        uint32_t diff = pixelDiff(drawn, panelPlanes());
+
+        // Drawing and conversion, kept like a frame rendered ahead
+        double best = 1e12;
+        epaper.renderAhead(true);
+        for (int round = 0; round < Rounds; round++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int run = 0; run < Runs; run++) {
+                epaper.reserveArena();
+                lite.draw(items, Items, content);
+                epaper.releaseArena();
+            }
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::micro>(end - start).count() / Runs);
+        }
+        epaper.renderAhead(false);
+        epaper.dropAhead();
+
+        printf("%-9s lite %8.1f us/frame, conversion alone %8.1f us, frames differ in %lu pixels\n",
+            modes[mode], best, timeFrame(ref), (unsigned long) diff);
+    }
+}
+#endif
+
+int main() {
+    static const struct {
+        const char *name;
+        std::function<Image(std::mt19937 &)> make;
+    } images[] = {
+        { "text", textImage },
+        { "ramp", rampImage },
+        { "noise", noiseImage },
+    };
+
+    epaper.init();
+#if !DISPLAY_RENDER_I1
+    other.init();
+#endif
+    std::mt19937 rng(1);
+
+    uint32_t luma_diff = 0;
+    for (uint32_t c = 0; c < 65536; c++) luma_diff += luma565(c) != oldLuma(c);
+    printf("Luma tables differ from the divide for %lu of 65536 colours\n", (unsigned long) luma_diff);
+
+#if DISPLAY_RENDER_I1
+    printf("I1 render path, %dx%d, %d row bands\n", X, Y, Band);
+    for (auto &image : images) {
+        Image img = image.make(rng);
+        printf("%-6s %8.1f us/frame, patched areas differ in %lu pixels\n",
+            image.name, timeFrame(img), (unsigned long) patchDiff(img, rng));
+    }
+#else
+    if constexpr (!Epaper::Portrait) {
+        // Thresholding only depends on luma and diffusion carries the same
+        // three channel error, so both must match the baseline bit for bit
+        printf("Baseline kernel, RGB888 frame buffer and three channel diffusion\n");
+        for (auto &image : images) {
+            Image img = image.make(rng);
+            std::vector<uint8_t> ref(Epaper::BufferSize);
+            baselineConvert(img, ref.data(), false);
+            epaper.setDitherMode(DITHER_THRESHOLD);
+            uint32_t threshold_diff = pixelDiff(ref, panelFrame(img));
+            baselineConvert(img, ref.data(), true);
+            epaper.setDitherMode(DITHER_DIFFUSION);
+            uint32_t diffusion_diff = pixelDiff(ref, panelFrame(img));
+            epaper.setDitherMode(DITHER_AUTO);
+            uint32_t auto_diff = pixelDiff(ref, panelFrame(img));
+            printf("%-6s %8.1f us/frame, threshold differs in %lu pixels, diffusion in %lu, auto in %lu\n",
+                image.name, timeBaseline(img), (unsigned long) threshold_diff,
+                (unsigned long) diffusion_diff, (unsigned long) auto_diff);
+        }
+    }
+
+    static const char *modes[] = { "threshold", "bayer", "diffusion", "auto" };
+    printf("RGB565 render path, %dx%d, %d row bands\n", X, Y, Band);
+    for (int mode = DITHER_THRESHOLD; mode <= DITHER_AUTO; mode++) {
+        epaper.setDitherMode((DitherMode) mode);
+        for (auto &image : images) {
+            Image img = image.make(rng);
+            printf("%-9s %-6s %8.1f us/frame, patched areas differ in %lu pixels\n",
+                modes[mode], image.name, timeFrame(img), (unsigned long) patchDiff(img, rng));
+        }
+    }
+
+    liteCheck(rng);
+
+#if DISPLAY_KWR
+    kwrCheck(other, epaper, rng);
+#else
+    kwrCheck(epaper, other, rng);
+#endif
+    epaper.setDitherMode(DISPLAY_DITHER);
+#endif
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "host.h"
+
+#include "lvgl.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_task_wdt.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+#include "epaper.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+
+static constexpr uint32_t Cols = PANEL_SOURCES * DISPLAY_B / 8;
+
+// Panel RAM, fed as transactions complete like the controller would be
+static uint8_t plane[2][PANEL_LINES * Cols];
+static uint8_t command;
+static uint32_t position;
+static bool partial;
+static uint8_t window[9];
+static uint32_t window_len;
+static uint32_t spi_bytes;
+static std::deque<spi_transaction_t*> queued;
+
+static void panelReceive(const spi_transaction_t *t) {
+    const uint8_t *data = (t->flags & SPI_TRANS_USE_TXDATA) ? t->tx_data : (const uint8_t*) t->tx_buffer;
+    uint32_t len = t->length / 8;
+    spi_bytes += len;
+
+    if (!t->user) {
+        command = data[0];
+        position = 0;
+        window_len = 0;
+        if (command == E_CMD_PARTIAL_ENTER) partial = true;
+        if (command == E_CMD_PARTIAL_EXIT) partial = false;
+        return;
+    }
+
+    for (uint32_t i = 0; i < len; i++, position++) {
+        if (command == E_CMD_PARTIAL_WINDOW) {
+            if (window_len < sizeof(window)) window[window_len++] = data[i];
+            continue;
+        }
+        if (command != E_CMD_DATA_TRASMISSION && command != E_CMD_DATA_TRASMISSION_2) continue;
+
+        uint8_t *ram = plane[command == E_CMD_DATA_TRASMISSION_2];
+        if (!partial) {
+            if (position < sizeof(plane[0])) ram[position] = data[i];
+            continue;
+        }
+        // Window bounds are in sources and gate lines, data fills it line by line
+        uint32_t col_start = ((window[0] << 8) | window[1]) / 8, col_end = ((window[2] << 8) | window[3]) / 8;
+        uint32_t line_start = (window[4] << 8) | window[5], line_end = (window[6] << 8) | window[7];
+        uint32_t width = col_end - col_start + 1;
+        uint32_t line = line_start + position / width;
+        if (line <= line_end) ram[line * Cols + col_start + position % width] = data[i];
+    }
+}
+
+const uint8_t *hostPanelPlane(bool old) {
+    return plane[!old];
+}
+
+uint32_t hostSpiBytes() {
+    return spi_bytes;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t, const spi_bus_config_t *, int) { return ESP_OK; }
+esp_err_t spi_bus_add_device(spi_host_device_t, const spi_device_interface_config_t *, spi_device_handle_t *) { return ESP_OK; }
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t, spi_transaction_t *t, TickType_t) {
+    queued.push_back(t);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t, spi_transaction_t **t, TickType_t) {
+    if (queued.empty()) return ESP_ERR_TIMEOUT;
+    *t = queued.front();
+    queued.pop_front();
+    panelReceive(*t);
+    return ESP_OK;
+}
+
+// The panel is never busy, waits return at once
+esp_err_t gpio_config(const gpio_config_t *) { return ESP_OK; }
+esp_err_t gpio_set_level(gpio_num_t, uint32_t) { return ESP_OK; }
+int gpio_get_level(gpio_num_t) { return 1; }
+esp_err_t gpio_isr_handler_add(gpio_num_t, gpio_isr_t, void *) { return ESP_OK; }
+esp_err_t gpio_intr_enable(gpio_num_t) { return ESP_OK; }
+esp_err_t gpio_intr_disable(gpio_num_t) { return ESP_OK; }
+esp_err_t gpio_wakeup_enable(gpio_num_t, gpio_int_type_t) { return ESP_OK; }
+esp_err_t gpio_wakeup_disable(gpio_num_t) { return ESP_OK; }
+esp_err_t esp_sleep_enable_gpio_wakeup(void) { return ESP_OK; }
+
+void vTaskDelay(TickType_t) {}
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return NULL; }
+uint32_t ulTaskNotifyTakeIndexed(UBaseType_t, BaseType_t, TickType_t) { return 1; }
+void vTaskNotifyGiveIndexedFromISR(TaskHandle_t, UBaseType_t, BaseType_t *) {}
+
+esp_err_t esp_task_wdt_status(TaskHandle_t) { return ESP_ERR_NOT_FOUND; }
+esp_err_t esp_task_wdt_add(TaskHandle_t) { return ESP_OK; }
+esp_err_t esp_task_wdt_reset(void) { return ESP_OK; }
+esp_err_t esp_task_wdt_delete(TaskHandle_t) { return ESP_OK; }
+
+const char *esp_err_to_name(esp_err_t) { return "ESP_FAIL"; }
+
+int64_t esp_timer_get_time(void) {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t) { return 0; }
+size_t heap_caps_get_largest_free_block(uint32_t) { return 0; }
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+// One display, the flush callback is driven by the benchmark itself
+struct _lv_display_t {
+    void *user_data;
+};
+static _lv_display_t display;
+
+lv_display_t *lv_display_create(int32_t, int32_t) { return &display; }
+void lv_display_set_user_data(lv_display_t *disp, void *user_data) { disp->user_data = user_data; }
+void *lv_display_get_user_data(lv_display_t *disp) { return disp->user_data; }
+void lv_display_set_flush_cb(lv_display_t *, lv_display_flush_cb_t) {}
+void *lv_display_add_event_cb(lv_display_t *, lv_event_cb_t, lv_event_code_t, void *) { return NULL; }
+void lv_display_set_buffers(lv_display_t *, void *, void *, uint32_t, lv_display_render_mode_t) {}
+void lv_display_set_draw_buffers(lv_display_t *, void *, void *) {}
+void lv_display_set_color_format(lv_display_t *, lv_color_format_t) {}
+void lv_display_flush_ready(lv_display_t *) {}
+bool lv_display_flush_is_last(lv_display_t *) { return true; }
+void *lv_event_get_user_data(lv_event_t *) { return NULL; }
+void *lv_event_get_param(lv_event_t *) { return NULL; }
+uint32_t lv_timer_handler(void) { return 0; }
+
+bool lv_font_get_glyph_dsc(const lv_font_t *font, lv_font_glyph_dsc_t *dsc, uint32_t letter, uint32_t letter_next) {
+    if (!font->get_glyph_dsc(font, dsc, letter, letter_next)) return false;
+    dsc->resolved_font = font;
+    return true;
+}
+
+// NVS in memory, only what the frame hash needs
+static std::map<std::string, uint32_t> nvs;
+
+Preferences::Preferences() {}
+Preferences::~Preferences() {}
+bool Preferences::begin(const char *, bool, const char *) { return true; }
+size_t Preferences::putUInt(const char *key, uint32_t value) { nvs[key] = value; return sizeof(value); }
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) { return nvs.count(key) ? nvs[key] : defaultValue; }
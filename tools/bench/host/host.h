@@ -0,0 +1,11 @@
+// Host stand-ins for the ESP-IDF drivers epaper.cpp talks to. SPI
+// transfers are decoded into panel RAM, so the benchmark can read back
+// exactly what a refresh would have sent.
+#pragma once
+
+#include <stdint.h>
+
+// The new plane (DTM2) as last written, one gate line after another, or
+// the old plane (DTM1), which KWR panels take black/white in
+const uint8_t *hostPanelPlane(bool old = false);
+uint32_t hostSpiBytes();
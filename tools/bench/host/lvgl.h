@@ -0,0 +1,122 @@
+// The parts of LVGL 9 the frame pipeline uses, enough to build epaper.cpp
+// and lite.cpp on a host. Nothing here renders, the benchmark supplies the
+// bands and the fonts.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef struct {
+    int32_t x1, y1, x2, y2;
+} lv_area_t;
+
+typedef struct _lv_display_t lv_display_t;
+typedef struct _lv_event_t lv_event_t;
+
+typedef enum {
+    LV_DISPLAY_RENDER_MODE_PARTIAL,
+    LV_DISPLAY_RENDER_MODE_DIRECT,
+    LV_DISPLAY_RENDER_MODE_FULL,
+} lv_display_render_mode_t;
+
+typedef enum {
+    LV_COLOR_FORMAT_I1 = 0x07,
+    LV_COLOR_FORMAT_RGB565 = 0x12,
+} lv_color_format_t;
+
+typedef enum {
+    LV_EVENT_INVALIDATE_AREA,
+    LV_EVENT_RENDER_START,
+} lv_event_code_t;
+
+typedef struct {
+    struct {
+        uint32_t magic: 8;
+        uint32_t cf: 8;
+        uint32_t flags: 16;
+        uint32_t w: 16;
+        uint32_t h: 16;
+        uint32_t stride: 16;
+        uint32_t reserved_2: 16;
+    } header;
+    uint32_t data_size;
+    const uint8_t *data;
+    const void *reserved;
+    const void *reserved_2;
+} lv_image_dsc_t;
+
+typedef struct _lv_font_t lv_font_t;
+
+typedef struct {
+    const lv_font_t *resolved_font;
+    uint16_t adv_w;
+    uint16_t box_w;
+    uint16_t box_h;
+    int16_t ofs_x;
+    int16_t ofs_y;
+    uint8_t format;
+    uint8_t is_placeholder: 1;
+    union {
+        uint32_t index;
+        const void *src;
+    } gid;
+} lv_font_glyph_dsc_t;
+
+struct _lv_font_t {
+    bool (*get_glyph_dsc)(const lv_font_t *font, lv_font_glyph_dsc_t *dsc, uint32_t letter, uint32_t letter_next);
+    const void *(*get_glyph_bitmap)(void);
+    int32_t line_height;
+    int32_t base_line;
+    uint8_t subpx: 2;
+    uint8_t kerning: 1;
+    int8_t underline_position;
+    int8_t underline_thickness;
+    const void *dsc;
+    const lv_font_t *fallback;
+    void *user_data;
+};
+
+typedef struct {
+    uint32_t bitmap_index: 20;
+    uint32_t adv_w: 12;
+    uint8_t box_w;
+    uint8_t box_h;
+    int8_t ofs_x;
+    int8_t ofs_y;
+} lv_font_fmt_txt_glyph_dsc_t;
+
+typedef enum {
+    LV_FONT_FMT_TXT_PLAIN = 0,
+    LV_FONT_FMT_TXT_COMPRESSED = 1,
+} lv_font_fmt_txt_bitmap_format_t;
+
+typedef struct {
+    const uint8_t *glyph_bitmap;
+    const lv_font_fmt_txt_glyph_dsc_t *glyph_dsc;
+    const void *cmaps;
+    const void *kern_dsc;
+    uint16_t kern_scale;
+    uint16_t cmap_num: 9;
+    uint16_t bpp: 4;
+    uint16_t kern_classes: 1;
+    uint16_t bitmap_format: 2;
+} lv_font_fmt_txt_dsc_t;
+
+typedef void (*lv_display_flush_cb_t)(lv_display_t *disp, const lv_area_t *area, uint8_t *px_map);
+typedef void (*lv_event_cb_t)(lv_event_t *e);
+
+lv_display_t *lv_display_create(int32_t hor_res, int32_t ver_res);
+void lv_display_set_user_data(lv_display_t *disp, void *user_data);
+void *lv_display_get_user_data(lv_display_t *disp);
+void lv_display_set_flush_cb(lv_display_t *disp, lv_display_flush_cb_t flush_cb);
+void *lv_display_add_event_cb(lv_display_t *disp, lv_event_cb_t event_cb, lv_event_code_t filter, void *user_data);
+void lv_display_set_buffers(lv_display_t *disp, void *buf1, void *buf2, uint32_t buf_size, lv_display_render_mode_t render_mode);
+void lv_display_set_draw_buffers(lv_display_t *disp, void *buf1, void *buf2);
+void lv_display_set_color_format(lv_display_t *disp, lv_color_format_t color_format);
+void lv_display_flush_ready(lv_display_t *disp);
+bool lv_display_flush_is_last(lv_display_t *disp);
+void *lv_event_get_user_data(lv_event_t *e);
+void *lv_event_get_param(lv_event_t *e);
+uint32_t lv_timer_handler(void);
+bool lv_font_get_glyph_dsc(const lv_font_t *font, lv_font_glyph_dsc_t *dsc, uint32_t letter, uint32_t letter_next);
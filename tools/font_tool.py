@@ -0,0 +1,329 @@
+#!/usr/bin/env python3
+#
+# Font subset tool. Cuts LVGL's built-in Montserrat faces down to the
+# glyphs the display can show and requantizes them to fewer bits per
+# pixel. Which label texts use which face is listed in main/fonts.json
+# and checked against the labels display.cpp sets. Writes the subsets as
+# LVGL font sources for the firmware and as asset pack entries. Standard
+# library only, it runs as a build step.
+#
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+# lv_font_fmt_txt_cmap_type_t
+CMAP_FORMAT0_FULL, CMAP_SPARSE_FULL, CMAP_FORMAT0_TINY, CMAP_SPARSE_TINY = range(4)
+
+FORMAT = re.compile(r"%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l|z)?([diuxXsc%])")
+DIGITS = set("0123456789-")
+
+
+def strip_comments(text):
+    return re.sub(r"/\*.*?\*/|//[^\n]*", "", text, flags=re.S)
+
+
+def c_array(text, name):
+    match = re.search(rf"\b{name}\[\]\s*=\s*\{{(.*?)\}};", text, re.S)
+    if not match:
+        raise ValueError(f"no array {name}")
+    return match.group(1)
+
+
+def c_ints(body):
+    return [int(v, 0) for v in re.findall(r"-?(?:0x[0-9a-fA-F]+|\d+)", body)]
+
+
+def c_field(body, field, default=None):
+    match = re.search(rf"\.{field}\s*=\s*([\w-]+)", body)
+    if not match:
+        if default is None:
+            raise ValueError(f"no field .{field}")
+        return default
+    value = match.group(1)
+    return int(value, 0) if re.fullmatch(r"-?(0x[0-9a-fA-F]+|\d+)", value) else value
+
+
+def read_font(path):
+    """Glyphs, cmaps and kerning of an LVGL lv_font_fmt_txt source file."""
+    with open(path) as f:
+        text = strip_comments(f.read())
+
+    bitmap = bytes(c_ints(c_array(text, "glyph_bitmap")))
+    glyphs = []
+    for entry in re.findall(r"\{([^{}]*\.bitmap_index[^{}]*)\}", c_array(text, "glyph_dsc")):
+        glyphs.append({k: c_field(entry, k) for k in ("bitmap_index", "adv_w", "box_w", "box_h", "ofs_x", "ofs_y")})
+
+    # Codepoint to glyph id, from every cmap type LVGL knows
+    cmap = {}
+    for entry in re.findall(r"\{([^{}]*\.range_start[^{}]*)\}", c_array(text, "cmaps")):
+        start, length, gid = c_field(entry, "range_start"), c_field(entry, "range_length"), c_field(entry, "glyph_id_start")
+        kind = c_field(entry, "type")
+        kind = kind if isinstance(kind, int) else ["LV_FONT_FMT_TXT_CMAP_FORMAT0_FULL", "LV_FONT_FMT_TXT_CMAP_SPARSE_FULL",
+                                                   "LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY", "LV_FONT_FMT_TXT_CMAP_SPARSE_TINY"].index(kind)
+        unicode = c_field(entry, "unicode_list", "NULL")
+        offsets = c_field(entry, "glyph_id_ofs_list", "NULL")
+        unicode = c_ints(c_array(text, unicode)) if unicode != "NULL" else None
+        offsets = c_ints(c_array(text, offsets)) if offsets != "NULL" else None
+        if kind == CMAP_FORMAT0_TINY:
+            cmap.update({start + i: gid + i for i in range(length)})
+        elif kind == CMAP_FORMAT0_FULL:
+            cmap.update({start + i: gid + o for i, o in enumerate(offsets) if o})
+        elif kind == CMAP_SPARSE_TINY:
+            cmap.update({start + u: gid + i for i, u in enumerate(unicode)})
+        else:
+            cmap.update({start + u: gid + o for u, o in zip(unicode, offsets)})
+
+    dsc = re.search(r"lv_font_fmt_txt_dsc_t\s+\w+\s*=\s*\{(.*?)\};", text, re.S).group(1)
+    font = re.search(r"lv_font_t\s+\w+\s*=\s*\{(.*?)\};", text, re.S).group(1)
+    result = {
+        "bitmap": bitmap,
+        "glyphs": glyphs,
+        "cmap": cmap,
+        "bpp": c_field(dsc, "bpp"),
+        "kern_scale": c_field(dsc, "kern_scale", 16),
+        "line_height": c_field(font, "line_height"),
+        "base_line": c_field(font, "base_line"),
+        "underline_position": c_field(font, "underline_position", 0),
+        "underline_thickness": c_field(font, "underline_thickness", 0),
+        "kern": None,
+    }
+    if c_field(dsc, "bitmap_format", 0) != 0:
+        raise ValueError(f"{path}: compressed bitmaps are not supported")
+
+    # Montserrat kerns by glyph classes, pair tables are not used by LVGL's fonts
+    if c_field(dsc, "kern_classes", 0) == 1:
+        kern = re.search(r"lv_font_fmt_txt_kern_classes_t\s+\w+\s*=\s*\{(.*?)\};", text, re.S).group(1)
+        result["kern"] = {
+            "left": c_ints(c_array(text, c_field(kern, "left_class_mapping"))),
+            "right": c_ints(c_array(text, c_field(kern, "right_class_mapping"))),
+            "values": c_ints(c_array(text, c_field(kern, "class_pair_values"))),
+            "left_count": c_field(kern, "left_class_cnt"),
+            "right_count": c_field(kern, "right_class_cnt"),
+        }
+    return result
+
+
+def unescape(s):
+    return bytes(s, "ascii").decode("unicode_escape")
+
+
+def scan_source(path):
+    """Texts given to labels and the string arrays of a C++ source."""
+    with open(path) as f:
+        text = strip_comments(f.read())
+
+    literal = r'"((?:[^"\\\n]|\\.)*)"'
+    labels = {unescape(s) for s in re.findall(r"(?:setLabel|lv_label_set_text)\([^;]*?" + literal, text)}
+    arrays = {}
+    for name, body in re.findall(r"(\w+)\[\]\s*=\s*\{([^{}]*)\};", text):
+        arrays[name] = [unescape(s) for s in re.findall(literal, body)]
+    return labels, arrays
+
+
+def expand(fmt, args):
+    """Every character printf can produce from fmt, %s taking any of args."""
+    chars, pos = set(), 0
+    for match in FORMAT.finditer(fmt):
+        chars |= set(fmt[pos:match.start()])
+        conv = match.group(1)
+        if conv in "diu":
+            chars |= DIGITS
+        elif conv in "xX":
+            chars |= set("0123456789abcdef" if conv == "x" else "0123456789ABCDEF")
+        elif conv == "s":
+            chars |= set("".join(args))
+        elif conv == "%":
+            chars.add("%")
+        pos = match.end()
+    return chars | set(fmt[pos:])
+
+
+def glyph_values(font, glyph):
+    """Pixel values of one glyph, row after row."""
+    bpp, count = font["bpp"], glyph["box_w"] * glyph["box_h"]
+    data, start = font["bitmap"], glyph["bitmap_index"] * 8
+    mask = (1 << bpp) - 1
+    return [(data[(start + i * bpp) >> 3] >> (8 - bpp - ((start + i * bpp) & 7))) & mask for i in range(count)]
+
+
+def pack_values(values, bpp):
+    bits = bytearray((len(values) * bpp + 7) // 8)
+    for i, v in enumerate(values):
+        bits[(i * bpp) >> 3] |= v << (8 - bpp - ((i * bpp) & 7))
+    return bytes(bits)
+
+
+def subset(font, chars, bpp):
+    """Only the glyphs for chars, ids 1.. in codepoint order, at bpp bits per pixel."""
+    missing = [c for c in chars if ord(c) not in font["cmap"]]
+    if missing:
+        raise SystemExit(f"glyphs missing from the font: {''.join(sorted(missing))!r}")
+
+    src_max = (1 << font["bpp"]) - 1
+    dst_max = (1 << bpp) - 1
+    codepoints = sorted(ord(c) for c in chars)
+    bitmap, glyphs, old_ids = bytearray(), [], []
+    for cp in codepoints:
+        old = font["cmap"][cp]
+        glyph = dict(font["glyphs"][old])
+        values = [(v * dst_max * 2 + src_max) // (src_max * 2) for v in glyph_values(font, glyph)]
+        glyph["bitmap_index"] = len(bitmap)
+        bitmap += pack_values(values, bpp)
+        glyphs.append(glyph)
+        old_ids.append(old)
+
+    kern = None
+    if font["kern"]:
+        k = font["kern"]
+        kern = dict(k, left=[0] + [k["left"][i] for i in old_ids], right=[0] + [k["right"][i] for i in old_ids])
+
+    return dict(font, bitmap=bytes(bitmap), glyphs=glyphs, codepoints=codepoints, bpp=bpp, kern=kern)
+
+
+def c_bytes(values, per_line=16):
+    return "\n".join("    " + " ".join(f"{v}," for v in values[i:i + per_line]) for i in range(0, len(values), per_line))
+
+
+def c_font(name, sub):
+    """An LVGL font source with one sparse cmap over the subset."""
+    first = sub["codepoints"][0]
+    glyphs = ["    {.bitmap_index = 0, .adv_w = 0, .box_w = 0, .box_h = 0, .ofs_x = 0, .ofs_y = 0}, /* id = 0 reserved */"]
+    for cp, g in zip(sub["codepoints"], sub["glyphs"]):
+        glyphs.append(f"    {{.bitmap_index = {g['bitmap_index']}, .adv_w = {g['adv_w']}, .box_w = {g['box_w']}, .box_h = {g['box_h']}, "
+                      f".ofs_x = {g['ofs_x']}, .ofs_y = {g['ofs_y']}}}, /* U+{cp:04X} */")
+
+    parts = [
+        f"static LV_ATTRIBUTE_LARGE_CONST const uint8_t {name}_bitmap[] = {{\n{c_bytes(list(sub['bitmap']))}\n}};",
+        f"static const lv_font_fmt_txt_glyph_dsc_t {name}_glyphs[] = {{\n" + "\n".join(glyphs) + "\n};",
+        f"static const uint16_t {name}_unicode[] = {{\n{c_bytes([cp - first for cp in sub['codepoints']])}\n}};",
+        f"""static const lv_font_fmt_txt_cmap_t {name}_cmaps[] = {{
+    {{
+        .range_start = {first}, .range_length = {sub['codepoints'][-1] - first + 1}, .glyph_id_start = 1,
+        .unicode_list = {name}_unicode, .glyph_id_ofs_list = NULL, .list_length = {len(sub['codepoints'])}, .type = LV_FONT_FMT_TXT_CMAP_SPARSE_TINY
+    }}
+}};""",
+    ]
+
+    kern_dsc = "NULL"
+    if sub["kern"]:
+        k = sub["kern"]
+        parts += [
+            f"static const uint8_t {name}_kern_left[] = {{\n{c_bytes(k['left'])}\n}};",
+            f"static const uint8_t {name}_kern_right[] = {{\n{c_bytes(k['right'])}\n}};",
+            f"static const int8_t {name}_kern_values[] = {{\n{c_bytes(k['values'])}\n}};",
+            f"""static const lv_font_fmt_txt_kern_classes_t {name}_kern = {{
+    .class_pair_values = {name}_kern_values,
+    .left_class_mapping = {name}_kern_left,
+    .right_class_mapping = {name}_kern_right,
+    .left_class_cnt = {k['left_count']},
+    .right_class_cnt = {k['right_count']},
+}};""",
+        ]
+        kern_dsc = f"&{name}_kern"
+
+    parts += [
+        f"""static const lv_font_fmt_txt_dsc_t {name}_dsc = {{
+    .glyph_bitmap = {name}_bitmap,
+    .glyph_dsc = {name}_glyphs,
+    .cmaps = {name}_cmaps,
+    .kern_dsc = {kern_dsc},
+    .kern_scale = {sub['kern_scale']},
+    .cmap_num = 1,
+    .bpp = {sub['bpp']},
+    .kern_classes = {1 if sub['kern'] else 0},
+    .bitmap_format = 0,
+}};""",
+        f"""const lv_font_t {name} = {{
+    .get_glyph_dsc = lv_font_get_glyph_dsc_fmt_txt,
+    .get_glyph_bitmap = lv_font_get_bitmap_fmt_txt,
+    .line_height = {sub['line_height']},
+    .base_line = {sub['base_line']},
+    .subpx = LV_FONT_SUBPX_NONE,
+    .underline_position = {sub['underline_position']},
+    .underline_thickness = {sub['underline_thickness']},
+    .dsc = &{name}_dsc,
+    .fallback = NULL,
+    .user_data = NULL,
+}};""",
+    ]
+    return "\n\n".join(parts)
+
+
+def pack_font(sub):
+    """Asset pack payload, see asset_font_t in main/assets.h."""
+    k = sub["kern"]
+    count = len(sub["codepoints"])
+    left_count, right_count = (k["left_count"], k["right_count"]) if k else (0, 0)
+    first = sub["codepoints"][0]
+    data = bytearray(struct.pack("<hhbbBxHHBBBxI", sub["line_height"], sub["base_line"],
+                                 sub["underline_position"], sub["underline_thickness"], sub["bpp"],
+                                 count, sub["kern_scale"], left_count, right_count, 1 if k else 0, first))
+
+    # Glyph id 0 is reserved, as in generated fonts
+    glyphs = [dict(bitmap_index=0, adv_w=0, box_w=0, box_h=0, ofs_x=0, ofs_y=0)] + sub["glyphs"]
+    for g in glyphs:
+        data += struct.pack("<IBBbb", g["bitmap_index"] | g["adv_w"] << 20, g["box_w"], g["box_h"], g["ofs_x"], g["ofs_y"])
+    data += struct.pack(f"<{count}H", *[cp - first for cp in sub["codepoints"]])
+    if k:
+        data += bytes(k["left"]) + bytes(k["right"]) + struct.pack(f"<{len(k['values'])}b", *k["values"])
+    data += b"\0" * (-len(data) % 4)
+    return bytes(data + sub["bitmap"])
+
+
+def subsets(manifest_path, font_dir):
+    """Name, source font and subset of every font in a manifest."""
+    with open(manifest_path) as f:
+        manifest = json.load(f)
+    root = os.path.dirname(os.path.abspath(manifest_path))
+    labels, arrays = scan_source(os.path.join(root, manifest["scan"]))
+
+    # A label text no font lists would show placeholder boxes
+    listed = set().union(*(spec["formats"] for spec in manifest["fonts"].values()))
+    if labels - listed:
+        raise SystemExit(f"label texts missing from {manifest_path}: {sorted(labels - listed)}")
+
+    result = []
+    for name, spec in sorted(manifest["fonts"].items()):
+        unused = set(spec["formats"]) - labels
+        if unused:
+            raise SystemExit(f"{name}: {sorted(unused)} no longer in {manifest['scan']}")
+        args = [s for array in spec.get("args", []) for s in arrays[array]]
+        chars = set().union(*(expand(fmt, args) for fmt in spec["formats"]))
+
+        font = read_font(os.path.join(font_dir, spec["source"]))
+        result.append((name, font, subset(font, chars, spec["bpp"])))
+    return result
+
+
+def build(args):
+    parts = ["// Generated by tools/font_tool.py from LVGL's fonts, do not edit", "", '#include "lvgl.h"']
+    for name, font, sub in subsets(args.manifest, args.font_dir):
+        parts += ["", c_font(name, sub)]
+        chars = "".join(chr(c) for c in sub["codepoints"])
+        print(f"{name}: {len(sub['glyphs'])} of {len(font['glyphs']) - 1} glyphs at {sub['bpp']} bpp, "
+              f"{len(sub['bitmap'])} of {len(font['bitmap'])} bitmap bytes: {chars!r}")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(parts) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Subset LVGL fonts to the glyphs the display uses")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("build", help="write the subsetted fonts as a C source")
+    p.add_argument("manifest")
+    p.add_argument("font_dir", help="LVGL's src/font directory")
+    p.add_argument("output")
+    p.set_defaults(func=build)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+#
+# Icon asset tool. Scales the source PNGs in main/icons to the sizes the
+# display draws them at and packs them as LVGL I1 images, so LVGL blits
+# them without its transform path. Standard library only, it runs as a
+# build step.
+#
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+# Sizes the display shows each icon at, in LVGL scale units (256 = 1x),
+# for the next collection and for the rows below it
+ICONS = {
+    "trash":       {"large": 750,  "small": 525},
+    "recycle":     {"large": 800,  "small": 560},
+    "gardenWaste": {"large": 1024, "small": 716},
+}
+
+# Same thresholds the panel driver uses for ordered dithering
+BAYER8 = [
+    [0, 32, 8, 40, 2, 34, 10, 42],
+    [48, 16, 56, 24, 50, 18, 58, 26],
+    [12, 44, 4, 36, 14, 46, 6, 38],
+    [60, 28, 52, 20, 62, 30, 54, 22],
+    [3, 35, 11, 43, 1, 33, 9, 41],
+    [51, 19, 59, 27, 49, 17, 57, 25],
+    [15, 47, 7, 39, 13, 45, 5, 37],
+    [63, 31, 55, 23, 61, 29, 53, 21],
+]
+
+PNG_MAGIC = b"\x89PNG\r\n\x1a\n"
+
+
+def read_png(path):
+    """Returns (width, height, rows of luma) for 8-bit grey, RGB or RGBA PNGs."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != PNG_MAGIC:
+        raise ValueError(f"{path}: not a PNG")
+
+    pos, idat = 8, b""
+    while pos < len(data):
+        length, kind = struct.unpack(">I4s", data[pos:pos + 8])
+        body = data[pos + 8:pos + 8 + length]
+        if kind == b"IHDR":
+            width, height, depth, color, _, _, interlace = struct.unpack(">IIBBBBB", body)
+        elif kind == b"IDAT":
+            idat += body
+        pos += 12 + length
+
+    channels = {0: 1, 2: 3, 6: 4}.get(color)
+    if depth != 8 or channels is None or interlace:
+        raise ValueError(f"{path}: only 8-bit non-interlaced grey, RGB or RGBA is supported")
+
+    raw = zlib.decompress(idat)
+    stride = width * channels
+    rows, prev = [], bytearray(stride)
+    for y in range(height):
+        kind = raw[y * (stride + 1)]
+        line = bytearray(raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)])
+        for i in range(stride):
+            a = line[i - channels] if i >= channels else 0
+            b = prev[i]
+            c = prev[i - channels] if i >= channels else 0
+            if kind == 1:
+                line[i] = (line[i] + a) & 0xFF
+            elif kind == 2:
+                line[i] = (line[i] + b) & 0xFF
+            elif kind == 3:
+                line[i] = (line[i] + (a + b) // 2) & 0xFF
+            elif kind == 4:
+                p = a + b - c
+                pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+                line[i] = (line[i] + (a if pa <= pb and pa <= pc else b if pb <= pc else c)) & 0xFF
+        prev = line
+
+        luma = []
+        for x in range(width):
+            px = line[x * channels:(x + 1) * channels]
+            if channels == 1:
+                l = px[0]
+            else:
+                l = (px[0] * 299 + px[1] * 587 + px[2] * 114 + 500) // 1000
+            if channels == 4:
+                # Transparent pixels sit on the white background
+                l = (l * px[3] + 255 * (255 - px[3]) + 127) // 255
+            luma.append(l)
+        rows.append(luma)
+    return width, height, rows
+
+
+def write_png(path, width, height, rgb):
+    def chunk(kind, body):
+        return struct.pack(">I", len(body)) + kind + body + struct.pack(">I", zlib.crc32(kind + body))
+
+    raw = b"".join(b"\x00" + bytes(rgb[y * width * 3:(y + 1) * width * 3]) for y in range(height))
+    with open(path, "wb") as f:
+        f.write(PNG_MAGIC)
+        f.write(chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 2, 0, 0, 0)))
+        f.write(chunk(b"IDAT", zlib.compress(raw, 9)))
+        f.write(chunk(b"IEND", b""))
+
+
+def scaled_size(size, scale):
+    return max(1, round(size * scale / 256))
+
+
+def scale_box(width, height, rows, out_w, out_h):
+    """Area-averaging resample, every source pixel weighted by its coverage."""
+    def spans(size, out):
+        result = []
+        for o in range(out):
+            lo, hi = o * size / out, (o + 1) * size / out
+            result.append([(i, min(hi, i + 1) - max(lo, i)) for i in range(int(lo), min(size, int(hi) + 1)) if min(hi, i + 1) > max(lo, i)])
+        return result
+
+    xs, ys = spans(width, out_w), spans(height, out_h)
+    out = []
+    for ry in ys:
+        line = []
+        for rx in xs:
+            total = weight = 0.0
+            for y, wy in ry:
+                for x, wx in rx:
+                    total += rows[y][x] * wx * wy
+                    weight += wx * wy
+            line.append(total / weight)
+        out.append(line)
+    return out
+
+
+def pack_i1(rows):
+    """LVGL I1: black and white ARGB palette, then MSB-first rows, 1 = white."""
+    data = bytearray(b"\x00\x00\x00\xff\xff\xff\xff\xff")
+    for y, line in enumerate(rows):
+        limit = BAYER8[y & 7]
+        bits = bytearray((len(line) + 7) // 8)
+        for x, l in enumerate(line):
+            if l > limit[x & 7] * 4 + 2:
+                bits[x >> 3] |= 0x80 >> (x & 7)
+        data += bits
+    return data
+
+
+def c_array(name, data):
+    lines = [f"const LV_ATTRIBUTE_MEM_ALIGN LV_ATTRIBUTE_LARGE_CONST uint8_t {name}[] = {{"]
+    for i in range(0, len(data), 16):
+        lines.append("    " + " ".join(f"0x{b:02x}," for b in data[i:i + 16]))
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def c_descriptor(name, map_name, w, h, size):
+    return f"""const lv_image_dsc_t {name} = {{
+    .header = {{
+        .magic = LV_IMAGE_HEADER_MAGIC,
+        .cf = LV_COLOR_FORMAT_I1,
+        .flags = 0,
+        .w = {w},
+        .h = {h},
+        .stride = {(w + 7) // 8},
+        .reserved_2 = 0
+    }},
+    .data_size = {size},
+    .data = {map_name},
+    .reserved = 0,
+    .reserved_2 = 0
+}};"""
+
+
+def build(args):
+    parts = ["// Generated by tools/icon_tool.py from main/icons, do not edit", "", '#include "images.h"']
+    packed = original = 0
+
+    for path in sorted(args.pngs):
+        name = os.path.splitext(os.path.basename(path))[0]
+        if name not in ICONS:
+            raise SystemExit(f"{path}: no sizes for icon '{name}' in ICONS")
+
+        width, height, rows = read_png(path)
+        original += width * height * 3
+        for variant, scale in ICONS[name].items():
+            w, h = scaled_size(width, scale), scaled_size(height, scale)
+            data = pack_i1(scale_box(width, height, rows, w, h))
+            packed += len(data)
+
+            symbol = name + variant.capitalize()
+            parts += ["", c_array(symbol + "Map", data), "", c_descriptor(symbol, symbol + "Map", w, h, len(data))]
+            print(f"{symbol}: {w}x{h}, {len(data)} bytes")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(parts) + "\n")
+    print(f"Icons take {packed} bytes of flash, {original} bytes as RGB888 originals ({original - packed} saved)")
+
+
+def export(args):
+    """Recovers source PNGs from a C file of RGB888 LVGL image maps."""
+    with open(args.source) as f:
+        text = f.read()
+
+    os.makedirs(args.outdir, exist_ok=True)
+    for match in re.finditer(r"const lv_image_dsc_t (\w+) = \{.*?\.w = (\d+),\s*\.h = (\d+),.*?\.data = (\w+),", text, re.S):
+        name, w, h, map_name = match.group(1), int(match.group(2)), int(match.group(3)), match.group(4)
+        body = re.search(rf"{map_name}\[\] = \{{(.*?)\}};", text, re.S).group(1)
+        rgb = [int(v, 16) for v in re.findall(r"0x[0-9a-fA-F]{2}", body)]
+        # LVGL stores RGB888 as B, G, R
+        rgb = [c for i in range(0, len(rgb), 3) for c in (rgb[i + 2], rgb[i + 1], rgb[i])]
+        path = os.path.join(args.outdir, name + ".png")
+        write_png(path, w, h, rgb)
+        print(f"{path}: {w}x{h}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pre-scale and pack display icons")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("build", help="write the packed icons as a C++ source")
+    p.add_argument("output")
+    p.add_argument("pngs", nargs="+")
+    p.set_defaults(func=build)
+
+    p = sub.add_parser("export", help="extract PNGs from RGB888 LVGL image maps")
+    p.add_argument("source")
+    p.add_argument("outdir")
+    p.set_defaults(func=export)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())